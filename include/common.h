@@ -11,6 +11,27 @@
 // #define RENDER_DEBUG_FACE_NORMALS   1
 // #define RENDER_DEBUG_WIREFRAME      1
 // #define RENDER_DEBUG_TRIANGLE_BOUNDING 1
+// #define RENDER_DEBUG_STATS 1
+
+// Number of pixels between two perspective corrections, must be a power of two
+#define PERSPECTIVE_SPAN_LENGTH     8
+
+// Fractional bits projected vertices are snapped to before rasterization
+#define RENDER_SUBPIXEL_BITS        4
+
+// Distance in pixels the x and y clip planes are pushed out of the frame. Triangles
+// within the guard band are only clipped to the frame by their bounding box.
+#define RENDER_GUARD_BAND           512
+
+// Meshes are drawn at their coarsest level of detail that still has a polygon for every
+// this many pixels of the square they cover on screen
+#define RENDER_LOD_PIXELS_PER_POLYGON 4
+
+// Submitted draw calls at least this many pixels large on screen are rasterized into a depth
+// buffer with a fraction of the resolution, the draw calls submitted after them are skipped
+// if they are entirely hidden behind it. Submitting large calls first makes this effective.
+#define RENDER_OCCLUDER_SIZE        30
+#define RENDER_OCCLUSION_DOWNSAMPLE 4
 
 #ifdef PLATFORM_PICO
 #define FRAME_WIDTH                 120
@@ -19,6 +40,32 @@
 #define ENABLE_OVERCLOCK            1
 
 #define DEFERRED_QUEUE_SIZE         32
+
+// Screen space is split into square tiles that are rasterized by exactly one
+// worker each. Binned triangles, bin entries and vertices created by clipping
+// are allocated from fixed pools. The tile size must be a multiple of 8.
+#define RENDER_WORKER_COUNT         2
+#define RENDER_TILE_SIZE            24
+#define RENDER_TRIANGLE_CAPACITY    512
+#define RENDER_BIN_CAPACITY         2048
+#define RENDER_CLIP_VERTEX_CAPACITY 256
+
+// Frames are rendered into one frame buffer while the previous one is still being sent to
+// the display. Every additional buffer needs about 28KB.
+#define RENDER_FRAME_BUFFER_COUNT   2
+
+// Keeps a copy of the last rendered frame and only rasterizes the tiles whose draw calls
+// changed. Needs about 58KB for the copy of the color and depth buffers.
+// #define RENDER_INCREMENTAL          1
+
+// Allows Shading::VisibilityBuffer, which otherwise falls back to the depth pre-pass. Needs
+// about 28KB for the triangle id of every pixel.
+// #define RENDER_VISIBILITY_BUFFER    1
+
+// Size in pixels of the images distant meshes are replaced with, and how many of them are
+// rendered again per frame. Every impostor needs size * size * 2 bytes.
+#define RENDER_IMPOSTOR_SIZE        16
+#define RENDER_IMPOSTOR_BUDGET      1
 #endif
 
 #ifdef PLATFORM_NATIVE
@@ -27,4 +74,19 @@
 
 #define SCREEN_WIDTH                1000
 #define SCREEN_HEIGHT               1000
+
+#define DEFERRED_QUEUE_SIZE         256
+
+#define RENDER_WORKER_COUNT         4
+#define RENDER_TILE_SIZE            24
+#define RENDER_TRIANGLE_CAPACITY    16384
+#define RENDER_BIN_CAPACITY         65535
+#define RENDER_CLIP_VERTEX_CAPACITY 4096
+#define RENDER_FRAME_BUFFER_COUNT   2
+
+#define RENDER_INCREMENTAL          1
+#define RENDER_VISIBILITY_BUFFER    1
+
+#define RENDER_IMPOSTOR_SIZE        32
+#define RENDER_IMPOSTOR_BUDGET      2
 #endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+
+#include "common.h"
+#include "mathematics.h"
+#include "ecs/object.h"
+#include "rendering/renderer.h"
+
+// Tree of world space boxes around objects, which lets scenes with many objects find the
+// visible or picked ones without testing each of them. The box of every leaf is grown by a
+// margin, so objects moving a little don't change the tree. Only leaves whose object left
+// its box are inserted again, the boxes of their ancestors are refit on the way up.
+class BoundingVolumeHierarchy {
+public:
+    // The volume is in the object space of the object. Returns the leaf holding it, which is
+    // valid until it is removed.
+    int Insert(Object& object, const BoundingVolume& volume);
+    void Remove(int leaf);
+
+    // Refits the leaves of the objects that moved, rotated or were scaled since the last
+    // update. Objects with a parent are refit every time, the parent might have moved.
+    void Update();
+
+    // Calls visit with every enabled object whose box intersects the frustum of the context,
+    // roughly from front to back. Subtrees behind the occluders of the main context are
+    // skipped, so submitting the objects while visiting lets them hide the ones behind.
+    template<typename Visit>
+    void Query(RenderContext& context, Visit visit);
+
+    // Nearest enabled object whose world space box the ray hits, or nullptr. The distance
+    // is measured in lengths of the direction.
+    Object* Raycast(vec3f origin, vec3f direction, float* distance = nullptr);
+
+    // Whether every node contains its children, the heights of siblings differ by at most one
+    // and the leaves contain their objects. Leaves of objects that moved since the last Update
+    // may fail.
+    bool Validate();
+
+private:
+    struct Node {
+        // Grown by the margin for leaves
+        BoundingVolume Bounds;
+        int Parent;
+        // -1 for leaves
+        int Left;
+        int Right;
+        // 0 for leaves, -1 for free nodes
+        int Height;
+        Object* _Object;
+        // Object space volume of leaves
+        BoundingVolume Volume;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> stack;
+    int root = -1;
+    // Free nodes are chained through their parent
+    int freeNode = -1;
+
+    int allocate();
+    void release(int node);
+    BoundingVolume fatten(const BoundingVolume& volume);
+    void insertLeaf(int leaf);
+    void removeLeaf(int leaf);
+    void refit(int node);
+    void refresh(int node);
+    int balance(int node);
+    int rotate(int node, int child);
+    void replaceChild(int parent, int child, int replacement);
+};
+
+template<typename Visit>
+void BoundingVolumeHierarchy::Query(RenderContext& context, Visit visit){
+    if(root == -1) return;
+
+    bool occlusion = &context == &Renderer::MainContext;
+    vec3<float> eye = vec3<float>(context.EyePosition);
+
+    stack.clear();
+    stack.push_back(root);
+
+    while(!stack.empty()){
+        int index = stack.back();
+        stack.pop_back();
+
+        const Node& node = nodes[index];
+        if(!context.IntersectsFrustrum(node.Bounds)) continue;
+        if(occlusion && Renderer::IsOccluded(node.Bounds)) continue;
+
+        if(node.Left == -1){
+            if(node._Object->Enabled) visit(*node._Object);
+            continue;
+        }
+
+        // The nearer child is pushed last, so it is visited first
+        vec3<float> left = vec3<float>((nodes[node.Left].Bounds.Min + nodes[node.Left].Bounds.Max) / 2) - eye;
+        vec3<float> right = vec3<float>((nodes[node.Right].Bounds.Min + nodes[node.Right].Bounds.Max) / 2) - eye;
+
+        if(left * left < right * right){
+            stack.push_back(node.Right);
+            stack.push_back(node.Left);
+        } else {
+            stack.push_back(node.Left);
+            stack.push_back(node.Right);
+        }
+    }
+}
@@ -4,6 +4,8 @@
 #include "time.hpp"
 
 class Object {
+    friend class BoundingVolumeHierarchy;
+
     public:
         bool Enabled = true;
         Object* Parent = nullptr;
@@ -26,16 +28,19 @@ class Object {
         FORCE_INLINE constexpr void SetPosition(const vec3f& position) {
             this->position = position;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         FORCE_INLINE constexpr void SetRotation(const Quaternion& rotation) {
             this->rotation = rotation;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         FORCE_INLINE constexpr void SetScale(const vec3f& scale) {
             this->scale = scale;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         mat4f& GetModelMatrix() {
@@ -61,21 +66,25 @@ class Object {
         FORCE_INLINE constexpr void Translate(const vec3f& translation) {
             position += translation;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         FORCE_INLINE constexpr void Rotate(const vec3f& rotation) {
             this->rotation = Quaternion::Euler(rotation) * this->rotation;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         FORCE_INLINE constexpr void Rotate(const Quaternion& rotation) {
             this->rotation = rotation * this->rotation;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         FORCE_INLINE void Scale(const vec3f& scale) {
             this->scale += scale;
             translationUpdated = true;
+            boundsUpdated = true;
         };
 
         FORCE_INLINE vec3f GetRight() {
@@ -95,5 +104,7 @@ protected:
     Quaternion rotation;
     vec3f scale;
     bool translationUpdated = true;
+    // Like translationUpdated, but only cleared once the hierarchy holding the object refitted its bounds
+    bool boundsUpdated = true;
     mat4f modelMatrix;
 };
\ No newline at end of file
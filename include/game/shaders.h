@@ -16,11 +16,9 @@ public:
         Parameters* params = (Parameters*)parameters;
         Texture2D* texture = params->_Texture;
 
-        vec3f normal = (data.V1.Normal * data.UVW(0) + data.V2.Normal * data.UVW(1) + data.V3.Normal * data.UVW(2));
-        normal = (data.ModelMatrix * vec4f(normal, 0)).xyz().normalize();
-        vec2f uv = (data.V1.UV * data.UVW(0) + data.V2.UV * data.UVW(1) + data.V3.UV * data.UVW(2));
+        vec3f normal = (data.ModelMatrix * vec4f(data.Normal, 0)).xyz().normalize();
         fixed diff = clamp(normal.dot(params->DirectionToLight) + 0.25fp, 0.02fp, 1fp);
-        data.FragmentColor = texture->Sample(uv);
+        data.FragmentColor = texture->Sample(data.UV);
 
         data.FragmentColor = Color(
             SCAST<uint8_t>(diff * ((uint16_t)data.FragmentColor.r * params->LightColor.r >> 8)),
@@ -41,10 +39,6 @@ public:
         Texture2D* _Texture;
         Color LightColor;
         vec3f DirectionToLight;
-
-        struct PassThrough {
-            Color triangleColor;
-        } PassThrough;
     };
 
     SHADER_AUTO_ID(FastPlanetShader){}
@@ -56,28 +50,54 @@ public:
         normal = (data.ModelMatrix * vec4f(normal, 0)).xyz().normalize();
 
         fixed diff = clamp(normal.dot(params->DirectionToLight) + 0.25fp, 0.02fp, 1fp);
-        params->PassThrough.triangleColor = Color(
+        data.TriangleColor = Color(
             SCAST<uint8_t>(diff * (uint16_t)params->LightColor.r),
             SCAST<uint8_t>(diff * (uint16_t)params->LightColor.g),
             SCAST<uint8_t>(diff * (uint16_t)params->LightColor.b),
             255
         );
-        data.TriangleColor = params->PassThrough.triangleColor;
     }
 
+    // FragmentColor holds the triangle color when the fragment program is invoked.
+    // Triangles are binned before they're rasterized, so it can't be passed through the parameters.
     inline void FragmentProgram(FragmentShaderData& data, void* parameters){
         Parameters* params = (Parameters*)parameters;
         Texture2D* texture = params->_Texture;
+        Color triangleColor = data.FragmentColor;
 
-        data.FragmentColor = texture->Sample(data.V1.UV * data.UVW(0) + data.V2.UV * data.UVW(1) + data.V3.UV * data.UVW(2));
+        data.FragmentColor = texture->Sample(data.UV);
         data.FragmentColor = Color(
-            SCAST<uint8_t>(SCAST<uint16_t>(fixed(params->PassThrough.triangleColor.r) * data.FragmentColor.r) >> 8),
-            SCAST<uint8_t>(SCAST<uint16_t>(fixed(params->PassThrough.triangleColor.g) * data.FragmentColor.g) >> 8),
-            SCAST<uint8_t>(SCAST<uint16_t>(fixed(params->PassThrough.triangleColor.b) * data.FragmentColor.b) >> 8),
+            SCAST<uint8_t>(SCAST<uint16_t>(fixed(triangleColor.r) * data.FragmentColor.r) >> 8),
+            SCAST<uint8_t>(SCAST<uint16_t>(fixed(triangleColor.g) * data.FragmentColor.g) >> 8),
+            SCAST<uint8_t>(SCAST<uint16_t>(fixed(triangleColor.b) * data.FragmentColor.b) >> 8),
             255
         );
     }
 
+    // The lighting is constant across the triangle and only converted once per span
+    inline void SpanProgram(SpanShaderData& data, void* parameters){
+        Parameters* params = (Parameters*)parameters;
+        Texture2D* texture = params->_Texture;
+        fixed r = fixed(data.TriangleColor.r);
+        fixed g = fixed(data.TriangleColor.g);
+        fixed b = fixed(data.TriangleColor.b);
+
+        for(int i = 0; i < data.Length; i++){
+            if(data.Mask & (1u << i)){
+                Color texel = texture->Sample(vec2f(data.U.Get(), data.V.Get()));
+                data.Output[i] = Color(
+                    SCAST<uint8_t>(SCAST<uint16_t>(r * texel.r) >> 8),
+                    SCAST<uint8_t>(SCAST<uint16_t>(g * texel.g) >> 8),
+                    SCAST<uint8_t>(SCAST<uint16_t>(b * texel.b) >> 8),
+                    255
+                ).ToColor565();
+            }
+
+            data.U.StepX();
+            data.V.StepX();
+        }
+    }
+
     void* CreateParameters(){
         return new Parameters();
     }
@@ -88,6 +108,7 @@ REGISTER_SHADERS(
     (FlatLightingShader)
     (SmoothLightingShader)
     (RainbowTestShader)
+    (CountingShader)
     (FlatShader)
     (PlanetShader)
     (FastPlanetShader)
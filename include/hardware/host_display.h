@@ -0,0 +1,98 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "common.h"
+#include "time.hpp"
+#include "rendering/color.h"
+
+// Stands in for the ST7789 on the host. A flipped frame buffer is converted on a separate
+// thread and held for as long as sending it to the display would take on the Pico, while
+// the next frame is rendered into the other buffer. The time spent presenting and the part
+// of it that wasn't hidden behind rendering are measured.
+namespace HostDisplay {
+    struct Stats {
+        uint64_t Frames;
+        // Time the flipped frames were being presented
+        uint64_t PresentMicroseconds;
+        // Time spent in Wait for a presentation to finish
+        uint64_t StallMicroseconds;
+    };
+
+    namespace {
+        std::mutex mutex;
+        std::condition_variable flipped;
+        std::condition_variable presented;
+
+        Color565* fb = nullptr;
+        bool busy = false;
+        uint64_t transferTime = 0;
+
+        Color pixels[FRAME_WIDTH * FRAME_HEIGHT];
+        Stats stats = {};
+
+        void present(){
+            while(true){
+                std::unique_lock<std::mutex> lock(mutex);
+                flipped.wait(lock, []{ return fb != nullptr; });
+                Color565* data = fb;
+                lock.unlock();
+
+                uint64_t start = Time::NowMicroseconds();
+
+                for(int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++){
+                    pixels[i] = Color(data[i]);
+                }
+
+                uint64_t elapsed = Time::NowMicroseconds() - start;
+                if(elapsed < transferTime) Time::Sleep(transferTime - elapsed);
+
+                lock.lock();
+                stats.Frames++;
+                stats.PresentMicroseconds += Time::NowMicroseconds() - start;
+                fb = nullptr;
+                busy = false;
+                presented.notify_all();
+            }
+        }
+    };
+
+    // The transfer time is how long a frame takes to reach the display, 0 only converts it
+    void Init(uint64_t transferMicroseconds){
+        transferTime = transferMicroseconds;
+        std::thread(present).detach();
+    }
+
+    // The frame buffer must not be drawn into until the flip is done
+    void Flip(Color565* data){
+        std::lock_guard<std::mutex> lock(mutex);
+        fb = data;
+        busy = true;
+        flipped.notify_one();
+    }
+
+    bool IsFlipping(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return busy;
+    }
+
+    void Wait(){
+        uint64_t start = Time::NowMicroseconds();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        presented.wait(lock, []{ return !busy; });
+        stats.StallMicroseconds += Time::NowMicroseconds() - start;
+    }
+
+    // Pixels of the last presented frame, must not be read while flipping
+    const Color* GetPixels(){
+        return pixels;
+    }
+
+    Stats GetStats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+};
@@ -70,6 +70,35 @@ struct Quaternion {
         );
     }
 
+    // Rotation whose matrix holds forward in its last row and up in its second, which is the way
+    // the camera looks along forward. Forward must be normalized and must not be parallel to up.
+    FORCE_INLINE static Quaternion LookRotation(const vec3<float>& forward, const vec3<float>& up) {
+        vec3<float> right = up.cross(forward).normalize();
+        vec3<float> u = forward.cross(right);
+
+        float m[3][3] = {
+            { right(0), right(1), right(2) },
+            { u(0), u(1), u(2) },
+            { forward(0), forward(1), forward(2) },
+        };
+
+        float trace = m[0][0] + m[1][1] + m[2][2];
+
+        if(trace > 0){
+            float s = sqrt(trace + 1) * 2;
+            return Quaternion((m[1][2] - m[2][1]) / s, (m[2][0] - m[0][2]) / s, (m[0][1] - m[1][0]) / s, s / 4);
+        } else if(m[0][0] > m[1][1] && m[0][0] > m[2][2]){
+            float s = sqrt(1 + m[0][0] - m[1][1] - m[2][2]) * 2;
+            return Quaternion(s / 4, (m[0][1] + m[1][0]) / s, (m[2][0] + m[0][2]) / s, (m[1][2] - m[2][1]) / s);
+        } else if(m[1][1] > m[2][2]){
+            float s = sqrt(1 + m[1][1] - m[0][0] - m[2][2]) * 2;
+            return Quaternion((m[0][1] + m[1][0]) / s, s / 4, (m[1][2] + m[2][1]) / s, (m[2][0] - m[0][2]) / s);
+        } else {
+            float s = sqrt(1 + m[2][2] - m[0][0] - m[1][1]) * 2;
+            return Quaternion((m[2][0] + m[0][2]) / s, (m[1][2] + m[2][1]) / s, s / 4, (m[0][1] - m[1][0]) / s);
+        }
+    }
+
     // converts the quaternion to a matrix, with rotation order yxz
     FORCE_INLINE constexpr mat4f ToMatrix() const {
         return mat4f({
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "mathematics/basic.h"
 #include "mathematics/vector.h"
+#include "mathematics/matrix.h"
 #include "fixed.h"
 
 class BoundingBox2D {
@@ -48,6 +49,43 @@ class BoundingVolume {
             return BoundingVolume(minBound, maxBound);
         };
 
+        BoundingVolume Union(const BoundingVolume& other) const {
+            return BoundingVolume(
+                vec3f(min(Min(0), other.Min(0)), min(Min(1), other.Min(1)), min(Min(2), other.Min(2))),
+                vec3f(max(Max(0), other.Max(0)), max(Max(1), other.Max(1)), max(Max(2), other.Max(2)))
+            );
+        };
+
+        bool Contains(const BoundingVolume& other) const {
+            return other.Min(0) >= Min(0) && other.Min(1) >= Min(1) && other.Min(2) >= Min(2) &&
+                   other.Max(0) <= Max(0) && other.Max(1) <= Max(1) && other.Max(2) <= Max(2);
+        };
+
+        // The axis aligned box enclosing the volume transformed by the matrix. Calculated with
+        // floats, the products of the matrix and the corners can overflow fixed point numbers.
+        BoundingVolume Transform(const mat4f& mat) const {
+            vec3<float> center = vec3<float>((Min + Max) / 2);
+            vec3<float> extent = vec3<float>(Max - Min) / 2;
+            vec3<float> minBound;
+            vec3<float> maxBound;
+
+            for(int r = 0; r < 3; r++){
+                float c = SCAST<float>(mat(r, 3));
+                float e = 0;
+
+                for(int i = 0; i < 3; i++){
+                    float m = SCAST<float>(mat(r, i));
+                    c += m * center(i);
+                    e += fabsf(m) * extent(i);
+                }
+
+                minBound[r] = c - e;
+                maxBound[r] = c + e;
+            }
+
+            return BoundingVolume(vec3f(minBound), vec3f(maxBound));
+        };
+
         // TODO: AI generated, test this
         FORCE_INLINE constexpr void GetCorners(vec3f (*corners)[8]) const {
             (*corners)[0] = Min;
@@ -67,4 +105,54 @@ FORCE_INLINE constexpr fixed edgeFunction(vec3f a, vec3f b, vec3f c){
 
 FORCE_INLINE constexpr int edgeFunctionFast(vec2<int> a, vec2<int> b, vec2<int> c){
     return (c.x() - a.x()) * (b.y() - a.y()) - (c.y() - a.y()) * (b.x() - a.x());
-}
\ No newline at end of file
+}
+
+#define INTERPOLANT_FRAC_BITS 24
+
+// A vertex attribute expressed as a plane over screen space. It is evaluated once
+// at the first pixel of a triangle and then stepped with additions only, instead of
+// being re-derived from the barycentric weights for every pixel.
+struct Interpolant {
+    int64_t Value;
+    int64_t DX;
+    int64_t DY;
+
+    // Barycentric weight of a vertex, given its edge function at the starting pixel,
+    // the per-pixel steps of that edge function and the (doubled) triangle area.
+    FORCE_INLINE static constexpr Interpolant Weight(int w, int dwdx, int dwdy, int area){
+        return Interpolant{
+            ((int64_t)w << INTERPOLANT_FRAC_BITS) / area,
+            ((int64_t)dwdx << INTERPOLANT_FRAC_BITS) / area,
+            ((int64_t)dwdy << INTERPOLANT_FRAC_BITS) / area
+        };
+    }
+
+    // Attribute with raw values a1, a2 and a3 at the vertices, expressed through the
+    // weights of the second and third vertex. The result keeps the unit of the raw
+    // values with INTERPOLANT_FRAC_BITS additional fractional bits.
+    FORCE_INLINE static constexpr Interpolant FromWeights(int64_t a1, int64_t a2, int64_t a3,
+                                                          const Interpolant& b2, const Interpolant& b3){
+        return Interpolant{
+            (a1 << INTERPOLANT_FRAC_BITS) + (a2 - a1) * b2.Value + (a3 - a1) * b3.Value,
+            (a2 - a1) * b2.DX + (a3 - a1) * b3.DX,
+            (a2 - a1) * b2.DY + (a3 - a1) * b3.DY
+        };
+    }
+
+    FORCE_INLINE static constexpr Interpolant FromWeights(fixed a1, fixed a2, fixed a3,
+                                                          const Interpolant& b2, const Interpolant& b3){
+        return FromWeights((int64_t)a1.value, (int64_t)a2.value, (int64_t)a3.value, b2, b3);
+    }
+
+    FORCE_INLINE constexpr fixed Get() const {
+        return fixed(Value, INTERPOLANT_FRAC_BITS);
+    }
+
+    FORCE_INLINE constexpr void StepX(){
+        Value += DX;
+    }
+
+    FORCE_INLINE constexpr void StepY(){
+        Value += DY;
+    }
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+#include "mathematics.h"
+#include "rendering/texture.h"
+#include "rendering/renderer.h"
+
+// Replaces a distant mesh with a small image of it, which is drawn as a billboard. The image
+// is rendered again once the mesh is seen, lit or rolled from a different enough angle, but
+// only the RENDER_IMPOSTOR_BUDGET most outdated impostors are rendered again in each frame.
+class Impostor {
+public:
+    Impostor() = default;
+    // The image is owned by the impostor, copies would free it twice
+    Impostor(const Impostor&) = delete;
+    Impostor& operator=(const Impostor&) = delete;
+    ~Impostor();
+
+    // Returns false if the mesh is too large on screen to be replaced, it has to be drawn
+    // instead. Otherwise the impostor is queued for rendering if its image is outdated.
+    // Must be called after Prepare, the model matrix may only be scaled uniformly.
+    bool Update(const Mesh& mesh, const mat4f& modelMat, const Material& material, vec3f lightDirection);
+    // Returns false as long as no image was rendered, the mesh has to be drawn instead
+    bool Draw();
+
+    // Renders the images of the queued impostors. Has to be called after all impostors of
+    // the frame were updated and before they are drawn.
+    static void RenderQueued();
+
+private:
+    Color16* data = nullptr;
+    bool valid = false;
+
+    const Mesh* mesh = nullptr;
+    const Material* material = nullptr;
+    mat4f modelMat;
+    // Object space radius of the mesh around the center of its volume
+    fixed meshRadius;
+    vec3f center;
+    fixed radius;
+
+    // Object space directions the mesh is currently seen, rolled and lit from
+    vec3<float> view;
+    vec3<float> up;
+    vec3<float> light;
+    // The same directions at the time the image was rendered
+    vec3<float> imageView;
+    vec3<float> imageUp;
+    vec3<float> imageLight;
+    // Distance from the center to the border of the image in world units
+    fixed extent;
+
+    void render();
+};
@@ -17,14 +17,44 @@ class Mesh {
         uint32_t VertexCount;
         uint32_t PolygonCount;
         BoundingVolume Volume;
+        // Object space plane of every polygon, the unit normal of its front side in xyz and
+        // the distance from the origin in w
+        vec4f* FacePlanes;
+        // Coarser level of detail the renderer draws instead once the mesh is small enough on screen
+        Mesh* Lod;
 
-        Mesh(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t polygonCount){
+        Mesh(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t polygonCount, Mesh* lod = nullptr){
             Vertices = vertices;
             VertexCount = vertexCount;
             Indices = indices;
             PolygonCount = polygonCount;
+            Lod = lod;
             
+            FacePlanes = new vec4f[polygonCount];
+
             RecalculateVolume();
+            RecalculateFacePlanes();
+        }
+
+        // The face planes are owned by the mesh, copies would share them
+        Mesh(const Mesh&) = delete;
+        Mesh& operator=(const Mesh&) = delete;
+
+        ~Mesh(){
+            delete[] FacePlanes;
+        }
+
+        // Chains the levels of detail the resource embedder writes for a model, passed as its
+        // <sym>_lod_vertices, _lod_indices, _lod_sizes and _lod_count tables, and returns the
+        // full mesh. The meshes are never freed.
+        static Mesh& FromLevels(const Vertex* const* vertices, const uint32_t* const* indices, const uint32_t* sizes, uint32_t count){
+            Mesh* mesh = nullptr;
+
+            for(int i = count - 1; i >= 0; i--){
+                mesh = new Mesh((Vertex*)vertices[i], sizes[i], (uint32_t*)indices[i], sizes[i] / 3, mesh);
+            }
+
+            return *mesh;
         }
 
         constexpr inline uint32_t GetPolygonCount(){
@@ -50,6 +80,36 @@ class Mesh {
             return Volume;
         }
 
+        // Follows the levels of detail down to the coarsest one suited for the size in pixels the
+        // mesh covers on screen
+        Mesh& SelectLod(int screenSize){
+            Mesh* mesh = this;
+            int pixels = min(screenSize, 4096) * min(screenSize, 4096);
+
+            while(mesh->Lod != nullptr && SCAST<int>(mesh->Lod->PolygonCount) * RENDER_LOD_PIXELS_PER_POLYGON >= pixels){
+                mesh = mesh->Lod;
+            }
+
+            return *mesh;
+        }
+
+        const Mesh& SelectLod(int screenSize) const {
+            return const_cast<Mesh*>(this)->SelectLod(screenSize);
+        }
+
+        // Must be called after changing vertex positions, the renderer culls back faces with these
+        void RecalculateFacePlanes(){
+            for (uint32_t i = 0; i < PolygonCount; i++){
+                // Normalizing in fixed point loses too much precision on small polygons
+                vec3<float> p1 = Vertices[Indices[i * 3]].Position;
+                vec3<float> p2 = Vertices[Indices[i * 3 + 1]].Position;
+                vec3<float> p3 = Vertices[Indices[i * 3 + 2]].Position;
+
+                vec3<float> normal = (p2 - p1).cross(p3 - p1).normalize();
+                FacePlanes[i] = vec4f(normal(0), normal(1), normal(2), normal.dot(p1));
+            }
+        }
+
     private:
         uint32_t polygonCount, vertexCount;
 };
\ No newline at end of file
@@ -21,8 +21,6 @@ class Camera : public Object {
         return projection;
     }
 
-    bool IntersectsFrustrum(const BoundingVolume& volume, const mat4f& translationMat);
-
     private:
         fixed fov;
         fixed near;
@@ -48,68 +46,186 @@ enum Culling {
     Back,
 };
 
+// Affine interpolation of varyings is cheap but warps textures on triangles that
+// span a large depth range. Perspective interpolation corrects the varyings every
+// PERSPECTIVE_SPAN_LENGTH pixels along a row and interpolates linearly in between.
+enum Interpolation {
+    Affine,
+    Perspective,
+};
+
+// The half-space rasterizer tests the edge functions of every pixel in the bounding
+// box, skipping 8x8 blocks outside of the triangle. The scanline rasterizer walks the
+// edges down the rows and only touches covered pixels, at the cost of a longer setup.
+enum Rasterization {
+    HalfSpace,
+    Scanline,
+};
+
+// Forward shading runs the fragment program for every fragment that passes the depth
+// test, so overdraw multiplies the shading cost. The depth pre-pass rasterizes every
+// tile twice, first writing depth only and then shading the fragments that are equal
+// to the final depth. With a visibility buffer, deferred draw calls only write depth and
+// the id of the covering triangle, and every tile shades each of its pixels once after
+// all of its triangles have been rasterized. Without RENDER_VISIBILITY_BUFFER the visibility
+// buffer mode uses the depth pre-pass instead.
+enum Shading {
+    Forward,
+    DepthPrePass,
+    VisibilityBuffer,
+};
+
+// Coarser rates run the fragment program once per 2x1 or 2x2 cell of pixels and copy the
+// color to every pixel of the cell that passed its depth test, depth stays per pixel. Cells
+// crossed by an edge of the triangle are shaded per row, a 2x2 cell as two 2x1 cells and a
+// 2x1 cell per pixel, so silhouettes keep the full rate. The scanline rasterizer and the
+// visibility buffer always shade at the full rate.
+enum ShadingRate {
+    Rate1x1,
+    Rate2x1,
+    Rate2x2,
+};
+
 class DrawCall {
 public:
-    DrawCall(Mesh& mesh, mat4f& modelMatrix, Material& material, Culling culling = Culling::Back, DepthTest depthTest = DepthTest::Less)
-        : _Mesh(mesh), ModelMatrix(modelMatrix), _Material(material), CullingMode(culling), DepthTestMode(depthTest) {}
+    DrawCall(Mesh& mesh, const mat4f& modelMatrix, Material& material, Culling culling = Culling::Back, DepthTest depthTest = DepthTest::Less,
+             Interpolation interpolation = Interpolation::Affine, Rasterization rasterization = Rasterization::HalfSpace,
+             ShadingRate shadingRate = ShadingRate::Rate1x1)
+        : _Mesh(mesh), ModelMatrix(modelMatrix), _Material(material), CullingMode(culling), DepthTestMode(depthTest),
+          InterpolationMode(interpolation), RasterizationMode(rasterization), ShadingRateMode(shadingRate) {}
     Mesh& _Mesh;
     mat4f ModelMatrix;
     Material& _Material;
     Culling CullingMode;
     DepthTest DepthTestMode;
+    Interpolation InterpolationMode;
+    Rasterization RasterizationMode;
+    ShadingRate ShadingRateMode;
+};
+
+// Rasterization always writes RGB565. RGBA4444 targets can additionally be resolved into a
+// texture, so they can be sampled like any other Texture2D. Targets without color have no
+// color buffer and are only drawn into by depth passes.
+enum ColorFormat {
+    RGB565,
+    RGBA4444,
+    NoColor,
+};
+
+// The buffers a frame is rasterized into. Offscreen targets must not be larger than the frame.
+class RenderTarget {
+public:
+    // Allocates the buffers. Without depth, only DepthTest::Never is used when drawing.
+    RenderTarget(vec2i16 size, ColorFormat format = ColorFormat::RGB565, bool depth = true);
+    // Rasterizes into existing buffers
+    RenderTarget(vec2i16 size, Color565* colorBuffer, uint16_t* depthBuffer);
+
+    vec2i16 Size;
+    ColorFormat Format;
+    Color565* ColorBuffer;
+    uint16_t* DepthBuffer;
+    // Written by Resolve for RGBA4444 targets. Pixels whose depth was never written are transparent.
+    Color16* TextureData;
+
+    // Coarse depth buffer maintained by the renderer
+    uint16_t* HiZ;
+    bool* HiZDirty;
+
+    void Clear(Color color);
+    void Resolve();
+};
+
+// A camera looking into a target and the matrices derived from them. Every context can be
+// drawn into independently of the others, the main frame is just the main context.
+class RenderContext {
+public:
+    RenderContext(RenderTarget& target, Camera& camera);
+
+    RenderTarget& Target;
+    Camera& _Camera;
+
+    // Size of the viewport in the top left corner of the target
+    vec2i16 Resolution;
+    BoundingBox2D Bounds;
+    mat4f RasterizationMat;
+    mat4f VP;
+    // Rasterization matrix * VP, from world space to the pixels of the viewport
+    mat4f RVP;
+    vec3f EyePosition;
+    // Kept in floats for the same reason Update calculates it with floats
+    mat<float, 4, 4> ViewProjection;
+    // World space planes of the view frustum, their unit normals point inside
+    vec4<float> FrustrumPlanes[6];
+
+    // Takes the matrices from the camera. Prepare does this for the main context.
+    void Update();
+    void SetViewport(vec2i16 size);
+
+    // Conservative tests against the frustum planes of the last Update. Volumes just outside of
+    // an edge of the frustum may pass, visible ones never fail.
+    bool IntersectsFrustrum(const BoundingVolume& volume, const mat4f& modelMat);
+    // Takes a volume that is already in world space
+    bool IntersectsFrustrum(const BoundingVolume& volume);
+    bool IntersectsFrustrum(vec3f center, fixed radius);
+
+private:
+    bool intersectsBox(const vec3<float>& center, const vec3<float>& extent);
 };
 
 namespace Renderer{
     extern Camera MainCamera;
-    extern Color565 FrameBuffer[FRAME_WIDTH * FRAME_HEIGHT];
-    extern uint16_t Zbuffer[FRAME_WIDTH * FRAME_HEIGHT];
+    // The main target draws into the frame buffer that changes with every SwapBuffers
+    extern RenderTarget MainTarget;
+    extern RenderContext MainContext;
 
     extern Font TextFont;
 
     extern Color ClearColor;
+    // Applies to the draw calls passed to Submit, DrawMesh always shades forward.
+    // Must not be changed while workers are rendering.
+    extern Shading ShadingMode;
 
-    namespace {
-        BoundingBox2D bounds = BoundingBox2D(vec2f(0, 0), vec2f(FRAME_WIDTH, FRAME_HEIGHT));
-        mat4f rasterizationMat = mat4f::identity();
-        mat4f VP = mat4f::identity();
-        mat4f RVP = mat4f::identity();
-
-        bool testAndSetDepth(vec2i16 pos, uint16_t val, DepthTest depthTestMode){
-            if(pos.x() < 0 || pos.x() >= FRAME_WIDTH || pos.y() < 0 || pos.y() >= FRAME_HEIGHT) return false;
-
-            switch(depthTestMode){
-                case DepthTest::Never:
-                    return true;
-                case DepthTest::Less:
-                    return val < Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] && (Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] = val);
-                case DepthTest::Greater:
-                    return val > Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] && (Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] = val);
-                case DepthTest::Equal:
-                    return val == Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] && (Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] = val);
-                case DepthTest::NotEqual:
-                    return val != Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] && (Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] = val);
-                case DepthTest::LessEqual:
-                    return val <= Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] && (Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] = val);
-                case DepthTest::GreaterEqual:
-                    return val >= Zbuffer[pos.y() * FRAME_WIDTH
-                     + pos.x()] && (Zbuffer[pos.y() * FRAME_WIDTH + pos.x()] = val);
-                default:
-                    return false;
-            }
-        }
-    };
 
     void Init();
+    // Only marks the tiles as cleared, they are filled once they are drawn to
     void Clear(Color color);
+    // Fills all tiles with pending clears. Needed before the buffers of the main target are accessed
+    // directly in a frame that was neither rendered nor upscaled.
+    void Resolve();
     void Prepare();
+    // Hands the finished frame over for presentation and moves on to the next frame buffer.
+    // The returned buffer stays untouched for the next RENDER_FRAME_BUFFER_COUNT - 1 frames.
+    Color565* SwapBuffers();
 
+    // Projects and bins the triangles of a draw call into screen tiles.
     void Submit(const DrawCall& call);
+    // Whether the frame differs from the previous one. Has to be called once all draw calls
+    // were submitted and before any worker calls Render. Frames that don't are neither
+    // rasterized nor restored, the buffer handed over by the last SwapBuffers still holds them
+    // and should be presented again instead. Always true without incremental rendering.
+    bool Changed();
+    // Called by every worker until it returns false. Each call rasterizes one whole tile.
     bool Render();
     void Finish();
+    // Draw calls are compared to the previous frame to find the tiles that need to be
+    // rasterized again. Meshes and textures are compared by address, so this has to be
+    // called when their contents change. Redraws every tile of this and the next frame.
+    void Invalidate();
 
+    // Resolution frames are rasterized at from the next Prepare on. Reduced resolutions only
+    // fill the top left corner of the frame buffer until Upscale is called.
+    void SetResolution(vec2i16 resolution);
+    vec2i16 GetResolution();
+    // Stretches the rasterized frame over the whole frame buffer, everything drawn afterwards
+    // is drawn at the full resolution again.
+    void Upscale();
+
+    // Unlike the other drawing functions, PutPixel neither resolves pending clears nor is it
+    // tracked for incremental rendering. Between Prepare and Render it has to be preceded by
+    // Resolve and followed by Invalidate.
     FORCE_INLINE void PutPixel(vec2i16 pos, Color color){
         if(pos.x() >= 0 && pos.x() < FRAME_WIDTH && pos.y() >= 0 && pos.y() < FRAME_HEIGHT){
-            FrameBuffer[pos.y() * FRAME_WIDTH + pos.x()] = color.ToColor565();
+            MainTarget.ColorBuffer[pos.y() * FRAME_WIDTH + pos.x()] = color.ToColor565();
         }
     }
     
@@ -118,13 +234,44 @@ namespace Renderer{
     void DrawLine(vec2i16 start, vec2i16 end, Color color, uint8_t lineWidth = 1);
     void DrawLine(vec3f p1, vec3f p2, Color color, uint8_t lineWidth = 1, DepthTest depthTestMode = DepthTest::Less);
     void DrawText(const char* text, vec2i16 pos, Color color);
-    void DrawMesh(const Mesh& mesh, const mat4f& modelMat, const Material& material, Culling cullingMode = Culling::Back, DepthTest depthTestMode = DepthTest::Less);
+    void DrawMesh(const Mesh& mesh, const mat4f& modelMat, const Material& material, Culling cullingMode = Culling::Back, DepthTest depthTestMode = DepthTest::Less,
+                  Interpolation interpolationMode = Interpolation::Affine, Rasterization rasterizationMode = Rasterization::HalfSpace,
+                  ShadingRate shadingRate = ShadingRate::Rate1x1);
+    // Draws into any context on the calling core. Meant for offscreen passes, which can run
+    // on several cores at once as long as each of them uses its own context.
+    void DrawMesh(RenderContext& context, const Mesh& mesh, const mat4f& modelMat, const Material& material, Culling cullingMode = Culling::Back,
+                  DepthTest depthTestMode = DepthTest::Less, Interpolation interpolationMode = Interpolation::Affine,
+                  Rasterization rasterizationMode = Rasterization::HalfSpace, ShadingRate shadingRate = ShadingRate::Rate1x1);
     void Blit(const Texture2D& tex, vec2i16 pos);
+    // Draws a texture facing the camera, centered at pos and extending extent world units to
+    // every side. Transparent texels are skipped, the others are depth tested at the depth of pos.
+    void DrawBillboard(const Texture2D& tex, vec3f pos, fixed extent, DepthTest depthTestMode = DepthTest::Less);
 
     vec3f WorldToScreen(vec3f worldPos);
+    // Whether a world space volume lies entirely behind the large draw calls submitted so far
+    // in the frame. Volumes partially in front of the camera are never occluded.
+    bool IsOccluded(const BoundingVolume& volume);
 
     namespace Debug {
         void DrawVolume(BoundingVolume& volume, mat4f& modelMat, Color color);
         void DrawOrientation(mat4f& modelMat);
+
+#ifdef RENDER_DEBUG_STATS
+        struct Stats {
+            // Pixels within the bounding boxes of the triangles, which a rasterizer testing
+            // every pixel of the box would have evaluated the edge functions at
+            uint32_t PixelsBounded;
+            // Pixels the edge functions have been evaluated at. Pixels of blocks entirely
+            // inside of a triangle and of scanline spans are drawn without testing them.
+            uint32_t PixelsTested;
+            // Pixels inside of a triangle, whether they passed the depth test or not
+            uint32_t PixelsCovered;
+            // Fragment program invocations
+            uint32_t FragmentsShaded;
+        };
+
+        // Sums up the rasterizer counters of all tiles of the frame since the last Prepare
+        Stats GetStats();
+#endif
     }
 };
\ No newline at end of file
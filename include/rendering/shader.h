@@ -24,12 +24,33 @@ struct TriangleShaderData {
 struct FragmentShaderData {
     const Vertex &V1, &V2, &V3;
     const mat4f& ModelMatrix;
-    const vec3f UVW;
+    // Vertex attributes interpolated for this fragment
+    const vec3f Normal;
+    const vec2f UV;
     const vec3f FragCoord;
     const vec2i16 ScreenSize;
     Color FragmentColor;
 };
 
+// A horizontal run of pixels of a triangle, starting at pixel (X, Y). The attributes
+// hold their value at the first pixel and StepX advances them to the next one. Only the
+// pixels set in Mask are covered and passed the depth test.
+struct SpanShaderData {
+    const Vertex &V1, &V2, &V3;
+    const mat4f& ModelMatrix;
+    Interpolant NormalX, NormalY, NormalZ;
+    Interpolant U, V;
+    // In the units of the depth buffer
+    Interpolant Depth;
+    const int16_t X, Y;
+    const int16_t Length;
+    const uint32_t Mask;
+    const vec2i16 ScreenSize;
+    const Color TriangleColor;
+    // Output[i] is the pixel at X + i, only the ones set in Mask may be written
+    Color565* const Output;
+};
+
 class Shader {
 public:
     inline static const uint64_t ID = -1;
@@ -37,7 +58,8 @@ public:
 
     Shader(uint64_t id = -1) : _ID(id) {}
     
-    // The triangle program runs for every triangle, regardless of visibility!
+    // The triangle program only runs for triangles that survived culling and clipping,
+    // though they may still be hidden behind others.
     inline void TriangleProgram(TriangleShaderData& input, void* parameters){
         
     }
@@ -46,9 +68,20 @@ public:
         
     }
 
+    // Shaders may also implement
+    //     inline void SpanProgram(SpanShaderData& data, void* parameters)
+    // to shade a whole run of pixels at once and share the setup between them. It is
+    // used wherever the rasterizer walks spans, the fragment program is still needed
+    // for pixels shaded on their own, e.g. when resolving the visibility buffer.
+
     virtual void* CreateParameters() = 0;
 };
 
+template<typename S>
+concept HasSpanProgram = requires(S& shader, SpanShaderData& data, void* parameters){
+    shader.SpanProgram(data, parameters);
+};
+
 class FlatShader : public Shader {
 public:
     struct Parameters {
@@ -109,8 +142,7 @@ public:
 
     inline void FragmentProgram(FragmentShaderData& data, void* parameters){
         Parameters* params = (Parameters*)parameters;
-        vec3f normal = (data.V1.Normal * data.UVW(0) + data.V2.Normal * data.UVW(1) + data.V3.Normal * data.UVW(2));
-        normal = (data.ModelMatrix * vec4f(normal, 0)).xyz().normalize();
+        vec3f normal = (data.ModelMatrix * vec4f(data.Normal, 0)).xyz().normalize();
         fixed diff = max(normal.dot(-params->LightDirection), 0fp);
         data.FragmentColor = Color(
                                 SCAST<uint8_t>(fixed(params->LightColor.r) * diff),
@@ -149,6 +181,32 @@ public:
     }
 };
 
+// Counts its fragment program invocations and draws the fragments in the color of the
+// triangle. Used by the tests to check how often pixels get shaded, the count isn't
+// synchronized between workers.
+class CountingShader : public Shader {
+public:
+    struct Parameters {
+        Color _Color;
+        uint32_t Fragments;
+    };
+
+    SHADER_AUTO_ID(CountingShader){
+    }
+
+    inline void TriangleProgram(TriangleShaderData& data, void* parameters){
+        data.TriangleColor = ((Parameters*)parameters)->_Color;
+    }
+
+    inline void FragmentProgram(FragmentShaderData& data, void* parameters){
+        ((Parameters*)parameters)->Fragments++;
+    }
+
+    void* CreateParameters() override {
+        return new Parameters();
+    }
+};
+
 class TextureShader : public Shader {
 public:
     struct Parameters {
@@ -162,11 +220,26 @@ public:
     inline void FragmentProgram(FragmentShaderData& data, void* parameters){
         TextureShader::Parameters* params = (TextureShader::Parameters*)parameters; \
         Texture2D* tex = params->_Texture;
-        vec2f uv = (data.V1.UV * data.UVW(0) + data.V2.UV * data.UVW(1) + data.V3.UV * data.UVW(2)); \
+        vec2f uv = data.UV; \
         uv = vec2f(uv.x() * params->TextureScale.x(), uv.y() * params->TextureScale.y()); \
         data.FragmentColor = tex->Sample(uv);
     }
 
+    inline void SpanProgram(SpanShaderData& data, void* parameters){
+        TextureShader::Parameters* params = (TextureShader::Parameters*)parameters;
+        Texture2D* tex = params->_Texture;
+        vec2f scale = params->TextureScale;
+
+        for(int i = 0; i < data.Length; i++){
+            if(data.Mask & (1u << i)){
+                data.Output[i] = tex->Sample(vec2f(data.U.Get() * scale(0), data.V.Get() * scale(1))).ToColor565();
+            }
+
+            data.U.StepX();
+            data.V.StepX();
+        }
+    }
+
     void* CreateParameters() override {
         return new Parameters();
     }
@@ -203,6 +276,14 @@ struct Material {
 #define A_TRIANGLE_END
 #define B_TRIANGLE_END
 
+#define LOOP_SELECT(seq) END(A_SELECT seq)
+#define BODY_SELECT(x) case x::ID: \
+        return selector.template Select<x>();
+#define A_SELECT(x) BODY_SELECT(x) B_SELECT
+#define B_SELECT(x) BODY_SELECT(x) A_SELECT
+#define A_SELECT_END
+#define B_SELECT_END
+
 #define REGISTER_SHADERS(shaders) \
 FORCE_INLINE void executeTriangleProgram(Shader& shader, TriangleShaderData& data, void* parameters){ \
     switch(shader._ID){ \
@@ -218,4 +299,16 @@ FORCE_INLINE void executeFragmentProgram(Shader& shader, FragmentShaderData& dat
         default: \
             break; \
     } \
+} \
+\
+/* Returns selector.Select<T>() for the registered type T of the shader, or */ \
+/* selector.Select<Shader>() for unregistered shaders. Used to pick code that */ \
+/* is specialized on the shader type once instead of switching per fragment. */ \
+template<typename Selector> \
+FORCE_INLINE auto selectShader(const Shader& shader, const Selector& selector){ \
+    switch(shader._ID){ \
+        LOOP_SELECT(shaders) \
+        default: \
+            return selector.template Select<Shader>(); \
+    } \
 }
\ No newline at end of file
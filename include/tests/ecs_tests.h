@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ecs/object.h"
+#include "ecs/bvh.h"
+#include "rendering/renderer.h"
+
+// Moves, inserts and removes objects in a hierarchy for a number of frames. After every
+// change the tree has to stay balanced and contain its objects, queries and rays have to
+// find the same objects as testing every object on its own.
+void bvhTest(){
+    const int count = 2000;
+    static Object objects[count];
+    int leaves[count];
+    bool inserted[count];
+
+    BoundingVolume volume = BoundingVolume(vec3f(-1), vec3f(1));
+    BoundingVolumeHierarchy hierarchy;
+    srand(1);
+
+    for(int i = 0; i < count; i++){
+        objects[i].SetPosition(vec3f(rand() % 400 - 200, rand() % 100 - 50, rand() % 400 - 200));
+        objects[i].SetScale(vec3f((rand() % 30 + 2) / 10.0f));
+        leaves[i] = hierarchy.Insert(objects[i], volume);
+        inserted[i] = true;
+        assert(hierarchy.Validate());
+    }
+
+    for(int frame = 0; frame < 100; frame++){
+        for(int i = 0; i < count; i++){
+            if(rand() % 4 == 0) objects[i].Translate(vec3f(rand() % 7 - 3, rand() % 7 - 3, rand() % 7 - 3));
+
+            if(rand() % 200 == 0){
+                if(inserted[i]) hierarchy.Remove(leaves[i]);
+                else leaves[i] = hierarchy.Insert(objects[i], volume);
+
+                inserted[i] = !inserted[i];
+            }
+        }
+
+        hierarchy.Update();
+        assert(hierarchy.Validate());
+
+        Renderer::MainCamera.SetPosition(vec3f(rand() % 200 - 100, rand() % 40 - 20, rand() % 200 - 100));
+        Renderer::MainCamera.SetRotation(Quaternion::Euler(vec3f(rand() % 60 - 30, rand() % 360, 0)));
+        Renderer::MainContext.Update();
+
+        bool visited[count] = {};
+        hierarchy.Query(Renderer::MainContext, [&](Object& object){
+            visited[&object - objects] = true;
+        });
+
+        vec3f origin = Renderer::MainContext.EyePosition;
+        vec3f direction = Renderer::MainCamera.GetRotation().ToMatrix()(2).xyz();
+        float distance;
+        Object* hit = hierarchy.Raycast(origin, direction, &distance);
+
+        for(int i = 0; i < count; i++){
+            assert(!visited[i] || inserted[i]);
+            if(inserted[i] && Renderer::MainContext.IntersectsFrustrum(volume, objects[i].GetModelMatrix())) assert(visited[i]);
+
+            if(!inserted[i] || &objects[i] == hit) continue;
+
+            // A hierarchy holding just the object serves as the reference
+            float other;
+            BoundingVolumeHierarchy single;
+            single.Insert(objects[i], volume);
+            if(single.Raycast(origin, direction, &other) != nullptr) assert(other >= distance);
+        }
+    }
+
+    printf("Bounding volume hierarchy: passed\n");
+}
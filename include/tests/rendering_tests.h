@@ -1,9 +1,13 @@
 #pragma once
 
+#include <assert.h>
+#include <string.h>
+
 #include "rendering/shader.h"
 #include "rendering/color.h"
 #include "rendering/texture.h"
 #include "rendering/renderer.h"
+#include "time.hpp"
 
 // extern Vertex cube_obj_vertices[36];
 // extern uint32_t cube_obj_indices[36];
@@ -121,6 +125,333 @@ void drawCubeTest(){
 }
 
 
+// Meshes and the flat green material the benchmarks draw with
+struct BenchmarkScene {
+    Mesh Cube = Mesh((Vertex*)&cubeVerts, 8, (uint32_t*)&cubeIndices, 12);
+    Mesh Pyramid = Mesh((Vertex*)&pyramidVerts, 5, (uint32_t*)&pyramidIndices, 6);
+    FlatShader Flat = FlatShader();
+    Material Green = Material(Flat);
+
+    BenchmarkScene(){
+        ((FlatShader::Parameters*)Green.Parameters)->_Color = Color::Green;
+    }
+};
+
+// Draws a grid of distant cubes whose triangles cover a pixel or less each and prints
+// the average time per frame.
+void smallTriangleBenchmark(){
+    BenchmarkScene scene;
+
+    const int frames = 200;
+    uint64_t start = Time::NowMicroseconds();
+
+    for(int i = 0; i < frames; i++){
+        Renderer::Prepare();
+
+        for(int y = 0; y < 16; y++){
+            for(int x = 0; x < 16; x++){
+                mat4f M = mat4f::translate(vec3f(x * 8 - 60, y * 8 - 60, 160)) * mat4f::euler(vec3f(i * 10, x * 20, y * 20));
+                Renderer::DrawMesh(scene.Cube, M, scene.Green);
+            }
+        }
+    }
+
+    printf("Small triangles: %lu us per frame\n", (unsigned long)((Time::NowMicroseconds() - start) / frames));
+}
+
+// Draws every triangle of the cube on its own at a range of sub-pixel offsets, distances and
+// orientations and counts the frames each pixel was drawn in. Pixels whose center lies within
+// the projected cube have to be drawn by exactly one of its front faces, pixels outside of it
+// by none. Centers closer than a quarter pixel to the outline may go either way.
+void fillRuleTest(Rasterization rasterizationMode = Rasterization::HalfSpace){
+    FlatShader flat = FlatShader();
+    Material white = Material(flat);
+    ((FlatShader::Parameters*)white.Parameters)->_Color = Color::White;
+
+    Color previousClearColor = Renderer::ClearColor;
+    Renderer::ClearColor = Color::Black;
+    Renderer::MainCamera.SetPosition(vec3f(0));
+    Renderer::MainCamera.SetRotation(Quaternion::Euler(vec3f(0)));
+
+    static uint8_t counts[FRAME_WIDTH * FRAME_HEIGHT];
+
+    for(int i = 0; i < 24; i++){
+        fixed distance = i % 3 == 2 ? 40 : 4 + i % 3;
+        vec3f offset = vec3f(fixed(i * 37 % 16) / 160, fixed(i * 11 % 16) / 160, 0);
+        mat4f M = mat4f::translate(vec3f(0, 0, distance) + offset) * mat4f::euler(vec3f(i * 15 + 10, i * 35 + 20, 0));
+
+        for(int p = 0; p < FRAME_WIDTH * FRAME_HEIGHT; p++) counts[p] = 0;
+
+        for(int t = 0; t < 12; t++){
+            Mesh triangle = Mesh((Vertex*)&cubeVerts, 8, (uint32_t*)&cubeIndices + t * 3, 1);
+
+            Renderer::Prepare();
+            Renderer::DrawMesh(triangle, M, white, Culling::Back, DepthTest::Never, Interpolation::Affine, rasterizationMode);
+
+            for(int p = 0; p < FRAME_WIDTH * FRAME_HEIGHT; p++){
+                if(Renderer::MainTarget.ColorBuffer[p].r != 0) counts[p]++;
+            }
+        }
+
+        // The outline of the cube is the convex hull of its projected corners
+        mat4f rMVP = Renderer::MainContext.RVP * M;
+        vec2<float> corners[8];
+        vec2<float> hull[9];
+        int hullCount = 0;
+
+        for(int c = 0; c < 8; c++){
+            vec3f corner = (rMVP * vec4f(cubeVerts[c].Position, 1)).homogenize();
+            corners[c] = vec2<float>(SCAST<float>(corner(0)), SCAST<float>(corner(1)));
+        }
+
+        int start = 0;
+        for(int c = 1; c < 8; c++){
+            if(corners[c](0) < corners[start](0)) start = c;
+        }
+
+        int current = start;
+        do {
+            hull[hullCount++] = corners[current];
+            int next = (current + 1) % 8;
+
+            for(int c = 0; c < 8; c++){
+                vec2<float> a = corners[next] - corners[current];
+                vec2<float> b = corners[c] - corners[current];
+                if(a(0) * b(1) - a(1) * b(0) < 0) next = c;
+            }
+
+            current = next;
+        } while(current != start && hullCount < 8);
+
+        for(int y = 0; y < FRAME_HEIGHT; y++){
+            for(int x = 0; x < FRAME_WIDTH; x++){
+                vec2<float> center = vec2<float>(x + 0.5f, y + 0.5f);
+                float nearest = INFINITY;
+
+                // Signed distance to the outline, positive inside
+                for(int h = 0; h < hullCount; h++){
+                    vec2<float> a = hull[h];
+                    vec2<float> b = hull[(h + 1) % hullCount];
+                    vec2<float> edge = b - a;
+                    vec2<float> toCenter = center - a;
+                    nearest = min(nearest, (edge(0) * toCenter(1) - edge(1) * toCenter(0)) / sqrtf(edge(0) * edge(0) + edge(1) * edge(1)));
+                }
+
+                int count = counts[y * FRAME_WIDTH + x];
+
+                if(nearest > 0.25f) assert(count == 1);
+                else if(nearest < -0.25f) assert(count == 0);
+                else assert(count <= 1);
+            }
+        }
+    }
+
+    Renderer::ClearColor = previousClearColor;
+
+    printf("Fill rule: passed\n");
+}
+
+#ifdef RENDER_INCREMENTAL
+// Moves a cube past a static one and a pyramid that comes and goes, and renders every few
+// frames again after Invalidate. The tiles restored by incremental rendering have to leave
+// the frame equal bit for bit to the redrawn one, although the frame buffers are swapped and
+// drawn over after every frame like the main loops do. Frames in which nothing moved have
+// to be reported unchanged.
+void incrementalTest(){
+    BenchmarkScene scene;
+    static Color565 color[FRAME_WIDTH * FRAME_HEIGHT];
+    static uint16_t depth[FRAME_WIDTH * FRAME_HEIGHT];
+
+    Renderer::MainCamera.SetPosition(vec3f(0));
+    Renderer::MainCamera.SetRotation(Quaternion::Euler(vec3f(0)));
+    Renderer::Invalidate();
+
+    int previousStep = -1;
+
+    auto render = [&](int step){
+        Renderer::Prepare();
+
+        // The cube stays where it was in the steps that leave out the pyramid
+        int position = step - (step + 1) / 5;
+        mat4f still = mat4f::translate(vec3f(0.5, 0.3, 6)) * mat4f::euler(vec3f(20, 30, 0));
+        mat4f moving = mat4f::translate(vec3f(position % 12 * 0.4 - 2.4, -0.2, 5 + position % 3)) * mat4f::euler(vec3f(position * 15, 10, 0));
+        Renderer::Submit(DrawCall(scene.Cube, still, scene.Green, Culling::Back, DepthTest::Less));
+        Renderer::Submit(DrawCall(scene.Cube, moving, scene.Green, Culling::Back, DepthTest::Less));
+
+        if(step % 5 != 4){
+            mat4f M = mat4f::translate(vec3f(1.5, -1.3, 4.5)) * mat4f::euler(vec3f(0, step / 5 * 40, 0));
+            Renderer::Submit(DrawCall(scene.Pyramid, M, scene.Green, Culling::None, DepthTest::Less));
+        }
+
+        bool changed = Renderer::Changed();
+        while(Renderer::Render());
+
+        return changed;
+    };
+
+    for(int i = 0; i < 48; i++){
+        // Every third frame repeats the one before
+        int step = i - i / 3;
+
+        bool changed = render(step);
+        assert(changed == (step != previousStep));
+        previousStep = step;
+
+        if(!changed) continue;
+
+        Renderer::Upscale();
+
+        if(i % 6 == 5){
+            memcpy(color, Renderer::MainTarget.ColorBuffer, sizeof(color));
+            memcpy(depth, Renderer::MainTarget.DepthBuffer, sizeof(depth));
+
+            Renderer::Invalidate();
+            assert(render(step));
+            Renderer::Upscale();
+
+            assert(memcmp(color, Renderer::MainTarget.ColorBuffer, sizeof(color)) == 0);
+            assert(memcmp(depth, Renderer::MainTarget.DepthBuffer, sizeof(depth)) == 0);
+        }
+
+        // Stands in for post-processing and the interface
+        Renderer::DrawBox(BoundingBox2D(vec2f(i * 2, 0), vec2f(i * 2 + 20, 30)), Color::Red);
+        Renderer::SwapBuffers();
+    }
+
+    printf("Incremental rendering: passed\n");
+}
+#endif
+
+#ifdef RENDER_DEBUG_STATS
+// Draws the cube and a squashed pyramid in a range of orientations, including thin
+// triangles seen almost edge on, and prints how many pixels the rasterizer tested
+// against the edge functions compared to the pixels the triangles actually covered.
+// The pixels within their bounding boxes are what testing every pixel of the box costs,
+// pixels of blocks the triangles entirely cover count as covered but not as tested.
+void rasterStatsBenchmark(Rasterization rasterizationMode = Rasterization::HalfSpace){
+    BenchmarkScene scene;
+
+    unsigned long bounded = 0;
+    unsigned long tested = 0;
+    unsigned long covered = 0;
+
+    for(int i = 0; i < 36; i++){
+        mat4f rot = mat4f::euler(vec3f(i * 10, i * 25, 0));
+        mat4f M = mat4f::translate(vec3f(0.5, 0, 3 + i % 6)) * rot;
+        mat4f M2 = mat4f::translate(vec3f(-1, 0.5, 4)) * rot * mat4f::scale(vec3f(0.05, 2, 1));
+
+        Renderer::Prepare();
+        Renderer::DrawMesh(scene.Cube, M, scene.Green, Culling::Back, DepthTest::Less, Interpolation::Affine, rasterizationMode);
+        Renderer::DrawMesh(scene.Pyramid, M2, scene.Green, Culling::None, DepthTest::Less, Interpolation::Affine, rasterizationMode);
+
+        Renderer::Debug::Stats stats = Renderer::Debug::GetStats();
+        bounded += stats.PixelsBounded;
+        tested += stats.PixelsTested;
+        covered += stats.PixelsCovered;
+    }
+
+    printf("Rasterizer: %lu pixels tested of %lu in bounds, %lu pixels covered\n", tested, bounded, covered);
+}
+#endif
+
+// Submits overlapping cubes back to front, so forward shading pays for every layer, and
+// returns the number of fragments shaded. The deferred modes have to shade every pixel
+// left visible exactly once. Visible counts the pixels whose depth was written. Render is
+// run on the calling core only.
+unsigned long shadingBenchmark(Shading shadingMode = Shading::Forward, ShadingRate shadingRate = ShadingRate::Rate1x1,
+                               unsigned long* visible = nullptr){
+    BenchmarkScene scene;
+    CountingShader counting = CountingShader();
+    Material material = Material(counting);
+    CountingShader::Parameters* counter = (CountingShader::Parameters*)material.Parameters;
+    counter->_Color = Color::Green;
+
+    Shading previousMode = Renderer::ShadingMode;
+    Renderer::ShadingMode = shadingMode;
+
+    unsigned long shaded = 0;
+    unsigned long written = 0;
+#ifdef RENDER_DEBUG_STATS
+    unsigned long covered = 0;
+#endif
+
+    for(int i = 0; i < 36; i++){
+        mat4f rot = mat4f::euler(vec3f(i * 10, i * 25, 0));
+
+        Renderer::Prepare();
+        counter->Fragments = 0;
+
+        for(int j = 0; j < 6; j++){
+            mat4f M = mat4f::translate(vec3f(0.2 * j - 0.5, 0, 8 - j)) * rot;
+            Renderer::Submit(DrawCall(scene.Cube, M, material, Culling::Back, DepthTest::Less, Interpolation::Affine,
+                                      Rasterization::HalfSpace, shadingRate));
+        }
+
+        while(Renderer::Render());
+
+        // Resolves the pending clears of the tiles nothing was drawn to
+        Renderer::Resolve();
+
+        // Pixels whose depth was written must have been colored as well, at any rate
+        Color565 green = Color::Green.ToColor565();
+        unsigned long pixels = 0;
+
+        for(int p = 0; p < FRAME_WIDTH * FRAME_HEIGHT; p++){
+            if(Renderer::MainTarget.DepthBuffer[p] == 65535) continue;
+
+            assert(memcmp(&Renderer::MainTarget.ColorBuffer[p], &green, sizeof(Color565)) == 0);
+            pixels++;
+        }
+
+        if(shadingMode != Shading::Forward && shadingRate == ShadingRate::Rate1x1) assert(counter->Fragments == pixels);
+
+        shaded += counter->Fragments;
+        written += pixels;
+
+#ifdef RENDER_DEBUG_STATS
+        covered += Renderer::Debug::GetStats().PixelsCovered;
+#endif
+    }
+
+    Renderer::ShadingMode = previousMode;
+
+#ifdef RENDER_DEBUG_STATS
+    printf("Shading: %lu fragments shaded, %lu pixels visible, %lu pixels covered\n", shaded, written, covered);
+#else
+    printf("Shading: %lu fragments shaded, %lu pixels visible\n", shaded, written);
+#endif
+
+    if(visible != nullptr) *visible = written;
+    return shaded;
+}
+
+// Run by the native build when it is started with the benchmark argument. The rasterizer
+// counters are only printed with RENDER_DEBUG_STATS defined.
+void runBenchmarks(){
+    smallTriangleBenchmark();
+
+#ifdef RENDER_DEBUG_STATS
+    rasterStatsBenchmark(Rasterization::HalfSpace);
+    rasterStatsBenchmark(Rasterization::Scanline);
+#endif
+
+    unsigned long visible;
+    unsigned long forward = shadingBenchmark(Shading::Forward, ShadingRate::Rate1x1, &visible);
+    unsigned long prePass = shadingBenchmark(Shading::DepthPrePass);
+    unsigned long deferred = shadingBenchmark(Shading::VisibilityBuffer);
+    assert(prePass < forward && deferred < forward);
+
+    unsigned long halfVisible;
+    unsigned long quarterVisible;
+    unsigned long half = shadingBenchmark(Shading::Forward, ShadingRate::Rate2x1, &halfVisible);
+    unsigned long quarter = shadingBenchmark(Shading::Forward, ShadingRate::Rate2x2, &quarterVisible);
+    // Depth stays per pixel. Cells crossed by an edge are shaded at a finer rate, so the
+    // coarse rates shade a little more than a half and a quarter of the fragments.
+    assert(halfVisible == visible && quarterVisible == visible);
+    assert(half >= forward / 2 && half < forward * 0.55);
+    assert(quarter >= forward / 4 && quarter < forward * 0.3);
+}
+
 #ifdef PLATFORM_PICO
 
 #include "hardware/st7789.h"
@@ -223,7 +554,8 @@ void picoCubeTest(){
 
         // Renderer::Blit(dirt, vec2i16(0));
 
-        ST7789::Flip((Color565*)&Renderer::FrameBuffer);
+        Renderer::Resolve();
+        ST7789::Flip(Renderer::MainTarget.ColorBuffer);
 
         printf("FPS: %f\n", 1.0 / (to_ms_since_boot(get_absolute_time()) - to_ms_since_boot(time)) * 1000.0);
     }
@@ -34,6 +34,25 @@ namespace Time {
         void Reset();
     };
 
+    // Scales the render resolution to hold a target frame time. Only the time spent in the
+    // "DrawMesh" section shrinks with the resolution, "PostProcessing" runs at the full
+    // resolution and is taken out of the budget.
+    namespace DynamicResolution {
+        namespace {
+            uint64_t targetFrameTime = 33333;
+            float minScale = 0.5f;
+            float scale = 1;
+        };
+
+        // A target of 0 disables the controller and returns to the full resolution
+        void SetTargetFrameTime(uint64_t microseconds);
+        void SetMinScale(float scale);
+        // Must be called once per frame after both sections were measured and before the
+        // profiler is reset. Returns the scale for the next frame.
+        float Update();
+        float GetScale();
+    };
+
     // float GetDeltaTimeSeconds(){
     //     return (float)deltaTime / 1000000.0f;
     // };
@@ -57,22 +57,41 @@ int main() {
 
         game_update();
 
-        while(ST7789::IsFlipping());
-
         Renderer::Prepare();
 
-        multicore_fifo_push_blocking(0);
-
+        Time::Profiler::Enter("DrawMesh");
         game_mesh_render();
 
+        // Triangles are binned during submission, so core 1 can only start
+        // rasterizing tiles once all draw calls have been submitted.
+        bool changed = Renderer::Changed();
+        multicore_fifo_push_blocking(0);
+
         while(Renderer::Render());
         Renderer::Finish();
+        Time::Profiler::Exit("DrawMesh");
 
-        PostProcessing::Apply((Color565*)&Renderer::FrameBuffer, vec2i16(120, 120));
+        // Nothing moved, the presented frame is kept together with what was drawn on top of it
+        if(!changed) continue;
+
+        Renderer::Upscale();
+
+        Time::Profiler::Enter("PostProcessing");
+        PostProcessing::Apply(Renderer::MainTarget.ColorBuffer, vec2i16(120, 120));
+        Time::Profiler::Exit("PostProcessing");
+
+        float scale = Time::DynamicResolution::Update();
+        Renderer::SetResolution(vec2i16(SCAST<int16_t>(FRAME_WIDTH * scale), SCAST<int16_t>(FRAME_HEIGHT * scale)));
 
         game_ui_render();
 
-        ST7789::Flip((Color565*)&Renderer::FrameBuffer);
+        // The previous frame was sent while this one was rendered into the other buffer,
+        // only what's left of the transfer has to be waited for.
+        Time::Profiler::Enter("Present");
+        while(ST7789::IsFlipping());
+        Time::Profiler::Exit("Present");
+
+        ST7789::Flip(Renderer::SwapBuffers());
     }
 
     return 0;
@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <cstring>
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -13,7 +14,15 @@
 #include "rendering/renderer.h"
 #include "rendering/postprocessing.h"
 #include "hardware/input.h"
+#include "hardware/host_display.h"
 #include "time.hpp"
+#include "tests/rendering_tests.h"
+#include "tests/ecs_tests.h"
+
+// Roughly the time the Pico needs to send a frame to the ST7789
+#define HOST_DISPLAY_TRANSFER_TIME 8000
+// Frames between two prints of the presentation stats
+#define HOST_DISPLAY_STATS_INTERVAL 300
 
 extern void game_init();
 extern void game_update();
@@ -36,12 +45,10 @@ SDL_Window* setupWindow(){
     return window;
 }
 
-std::mutex barrierStartMutex;
-std::barrier renderStartBarrier{2};
-std::mutex barrierDoneMutex;
-std::barrier renderDoneBarrier{2};
+std::barrier renderStartBarrier{RENDER_WORKER_COUNT};
+std::barrier renderDoneBarrier{RENDER_WORKER_COUNT};
 
-void core1(){
+void renderWorker(){
     while(true){
         renderStartBarrier.arrive_and_wait();
         while(Renderer::Render());
@@ -50,6 +57,24 @@ void core1(){
 }
 
 int main(int argc, char** argv){
+    if(argc > 1 && strcmp(argv[1], "benchmark") == 0){
+        Time::Init();
+        Renderer::Init();
+        runBenchmarks();
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "test") == 0){
+        Renderer::Init();
+        fillRuleTest(Rasterization::HalfSpace);
+        fillRuleTest(Rasterization::Scanline);
+        bvhTest();
+#ifdef RENDER_INCREMENTAL
+        incrementalTest();
+#endif
+        return 0;
+    }
+
     SDL_Window* window = setupWindow();
     SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
     SDL_SetWindowMinimumSize(window, FRAME_WIDTH, FRAME_HEIGHT);
@@ -69,10 +94,14 @@ int main(int argc, char** argv){
     Time::Init();
     Input::Init();
     Renderer::Init();
+    HostDisplay::Init(HOST_DISPLAY_TRANSFER_TIME);
 
     game_init();
 
-    std::thread secondThread(core1);
+    std::thread workers[RENDER_WORKER_COUNT - 1];
+    for(std::thread& worker : workers){
+        worker = std::thread(renderWorker);
+    }
 
     while(true){
         Time::Tick();
@@ -94,28 +123,50 @@ int main(int argc, char** argv){
 
         Renderer::Prepare();
 
-        renderStartBarrier.arrive_and_wait();
-
         Time::Profiler::Enter("DrawMesh");
         game_mesh_render();
+
+        // Triangles are binned during submission, so the workers can only start
+        // rasterizing tiles once all draw calls have been submitted.
+        bool changed = Renderer::Changed();
+        renderStartBarrier.arrive_and_wait();
         while(Renderer::Render());
         Renderer::Finish();
         Time::Profiler::Exit("DrawMesh");
 
+        // Nothing moved, the presented frame is kept together with what was drawn on top of it
+        if(!changed) continue;
+
+        Renderer::Upscale();
+
         Time::Profiler::Enter("PostProcessing");
-        PostProcessing::Apply((Color565*)&Renderer::FrameBuffer, vec2i16(120, 120));
+        PostProcessing::Apply(Renderer::MainTarget.ColorBuffer, vec2i16(120, 120));
         Time::Profiler::Exit("PostProcessing");
 
+        float scale = Time::DynamicResolution::Update();
+        Renderer::SetResolution(vec2i16(SCAST<int16_t>(FRAME_WIDTH * scale), SCAST<int16_t>(FRAME_HEIGHT * scale)));
+
         game_ui_render();
 
+        // The previous frame was presented while this one was rendered into the other buffer.
+        // It's shown now, one frame late, as SDL has to be called from this thread.
+        Time::Profiler::Enter("Present");
+        HostDisplay::Wait();
+        Time::Profiler::Exit("Present");
+
         SDL_LockSurface(surface);
-        static Color pixels[FRAME_WIDTH * FRAME_HEIGHT];
-        for(int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++){
-            pixels[i] = Color(Renderer::FrameBuffer[i]);
-        }
-        memcpy(surface->pixels, &pixels, FRAME_WIDTH * FRAME_HEIGHT * sizeof(Color));
+        memcpy(surface->pixels, HostDisplay::GetPixels(), FRAME_WIDTH * FRAME_HEIGHT * sizeof(Color));
         SDL_UnlockSurface(surface);
 
+        HostDisplay::Flip(Renderer::SwapBuffers());
+
+        if(Time::GetFrameCount() % HOST_DISPLAY_STATS_INTERVAL == 0){
+            HostDisplay::Stats stats = HostDisplay::GetStats();
+            printf("Presentation: %llu us per frame, %llu us hidden behind rendering\n",
+                   (unsigned long long)(stats.PresentMicroseconds / stats.Frames),
+                   (unsigned long long)((stats.PresentMicroseconds - min(stats.StallMicroseconds, stats.PresentMicroseconds)) / stats.Frames));
+        }
+
 
         SDL_RenderClear(renderer);
         SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
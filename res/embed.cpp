@@ -5,6 +5,8 @@
 #include <fstream>
 #include <cstring>
 #include <vector>
+#include <string>
+#include <algorithm>
 #include <lodepng.h>
 #include "mathematics/vector.h"
 #include "rendering/mesh.h"
@@ -20,6 +22,234 @@ FILE* open_or_exit(const char* fname, const char* mode)
     return f;
 }
 
+// Lower levels of detail generated for every mesh, each with about half of the polygons of the
+// level before. No level is generated once a level has fewer than LOD_MIN_POLYGONS polygons,
+// or once the simplification can't remove a quarter of the polygons of the level before, which
+// happens when most of the remaining positions lie on seams or open boundaries.
+#define LOD_COUNT        3
+#define LOD_MIN_POLYGONS 32
+
+// Sum of the squared distances to a set of planes, stored as the upper triangle of a symmetric 4x4 matrix
+struct Quadric {
+    double m[10] = {};
+
+    void addPlane(double a, double b, double c, double d, double weight){
+        double p[4] = { a, b, c, d };
+        int k = 0;
+
+        for(int i = 0; i < 4; i++){
+            for(int j = i; j < 4; j++){
+                m[k++] += p[i] * p[j] * weight;
+            }
+        }
+    }
+
+    void add(const Quadric& other){
+        for(int i = 0; i < 10; i++) m[i] += other.m[i];
+    }
+
+    double evaluate(const vec3<float>& v) const {
+        double p[4] = { v(0), v(1), v(2), 1 };
+        double result = 0;
+        int k = 0;
+
+        for(int i = 0; i < 4; i++){
+            for(int j = i; j < 4; j++){
+                result += m[k++] * p[i] * p[j] * (i == j ? 1 : 2);
+            }
+        }
+
+        return result;
+    }
+};
+
+// Corners of the triangles index wedges, unique combinations of a position, normal and uv.
+// Positions shared by several wedges lie on a seam of the uv or normal layout.
+struct Wedge {
+    Vertex _Vertex;
+    int Position;
+};
+
+vec3<float> triangleNormal(const std::vector<vec3<float>>& positions, int a, int b, int c){
+    return (positions[b] - positions[a]).cross(positions[c] - positions[a]);
+}
+
+// Removes about half of the triangles with quadric error metric edge collapses. Every collapse
+// moves one position onto a neighbouring one, so the remaining wedges keep their attributes.
+// Positions on seams and on open boundaries are never moved, which keeps the levels free of cracks.
+std::vector<int> simplify(const std::vector<Wedge>& wedges, const std::vector<vec3<float>>& positions, const std::vector<int>& indices){
+    std::vector<int> result = indices;
+    int triangleCount = indices.size() / 3;
+    int targetCount = triangleCount / 2;
+
+    std::vector<Quadric> quadrics(positions.size());
+    std::vector<int> wedgeCount(positions.size(), 0);
+    std::vector<std::vector<int>> triangles(positions.size());
+    std::vector<bool> removed(triangleCount, false);
+
+    for(int i = 0; i < wedges.size(); i++) wedgeCount[wedges[i].Position]++;
+
+    for(int t = 0; t < triangleCount; t++){
+        int a = wedges[result[t * 3]].Position, b = wedges[result[t * 3 + 1]].Position, c = wedges[result[t * 3 + 2]].Position;
+        vec3<float> normal = triangleNormal(positions, a, b, c);
+        float area = sqrtf(normal * normal);
+
+        if(area > 0){
+            normal = normal / area;
+            for(int p : { a, b, c }){
+                quadrics[p].addPlane(normal(0), normal(1), normal(2), -(normal * positions[a]), area);
+                triangles[p].push_back(t);
+            }
+        }
+    }
+
+    auto position = [&](int t, int corner){ return wedges[result[t * 3 + corner]].Position; };
+    auto contains = [&](int t, int p){ return position(t, 0) == p || position(t, 1) == p || position(t, 2) == p; };
+
+    auto neighbours = [&](int p){
+        std::vector<int> list;
+        for(int t : triangles[p]){
+            if(removed[t]) continue;
+            for(int corner = 0; corner < 3; corner++){
+                int q = position(t, corner);
+                if(q != p && std::find(list.begin(), list.end(), q) == list.end()) list.push_back(q);
+            }
+        }
+        return list;
+    };
+
+    // An edge of an open boundary is only used by one triangle
+    auto onBoundary = [&](int p){
+        for(int q : neighbours(p)){
+            int shared = 0;
+            for(int t : triangles[p]) if(!removed[t] && contains(t, q)) shared++;
+            if(shared != 2) return true;
+        }
+        return false;
+    };
+
+    std::vector<bool> locked(positions.size());
+    for(int p = 0; p < positions.size(); p++) locked[p] = wedgeCount[p] != 1 || onBoundary(p);
+
+    auto canCollapse = [&](int from, int to){
+        // Both positions must only share the two vertices opposite of their edge, otherwise the
+        // collapse would fold the surface onto itself
+        std::vector<int> fromNeighbours = neighbours(from);
+        std::vector<int> toNeighbours = neighbours(to);
+        int shared = 0;
+        for(int p : fromNeighbours) if(std::find(toNeighbours.begin(), toNeighbours.end(), p) != toNeighbours.end()) shared++;
+        if(shared != 2) return false;
+
+        for(int t : triangles[from]){
+            if(removed[t] || contains(t, to)) continue;
+
+            int p[3] = { position(t, 0), position(t, 1), position(t, 2) };
+            vec3<float> before = triangleNormal(positions, p[0], p[1], p[2]);
+            for(int corner = 0; corner < 3; corner++) if(p[corner] == from) p[corner] = to;
+            vec3<float> after = triangleNormal(positions, p[0], p[1], p[2]);
+
+            if(before * after <= 0) return false;
+        }
+
+        return true;
+    };
+
+    while(triangleCount > targetCount){
+        int bestFrom = -1, bestTo = -1;
+        double bestCost = 0;
+
+        for(int from = 0; from < positions.size(); from++){
+            if(locked[from]) continue;
+
+            for(int to : neighbours(from)){
+                Quadric q = quadrics[from];
+                q.add(quadrics[to]);
+                double cost = q.evaluate(positions[to]);
+
+                if((bestFrom == -1 || cost < bestCost) && canCollapse(from, to)){
+                    bestFrom = from;
+                    bestTo = to;
+                    bestCost = cost;
+                }
+            }
+        }
+
+        if(bestFrom == -1) break;
+
+        // The moved position is no seam, so all triangles around it lie on the same side of a
+        // possible seam at the other position and use the same wedge there
+        int toWedge = -1;
+        for(int t : triangles[bestFrom]){
+            if(removed[t] || !contains(t, bestTo)) continue;
+            for(int corner = 0; corner < 3; corner++) if(position(t, corner) == bestTo) toWedge = result[t * 3 + corner];
+            removed[t] = true;
+            triangleCount--;
+        }
+
+        for(int t : triangles[bestFrom]){
+            if(removed[t]) continue;
+            for(int corner = 0; corner < 3; corner++) if(position(t, corner) == bestFrom) result[t * 3 + corner] = toWedge;
+            triangles[bestTo].push_back(t);
+        }
+
+        quadrics[bestTo].add(quadrics[bestFrom]);
+        triangles[bestFrom].clear();
+    }
+
+    std::vector<int> remaining;
+    for(int t = 0; t < removed.size(); t++){
+        if(removed[t]) continue;
+        remaining.push_back(result[t * 3]);
+        remaining.push_back(result[t * 3 + 1]);
+        remaining.push_back(result[t * 3 + 2]);
+    }
+
+    return remaining;
+}
+
+void writeMesh(std::ofstream& out, const std::string& sym, const std::vector<Vertex>& bundledVertices){
+    // write the vertices to the file as a vertex array
+    out << "extern const Vertex " << sym  << "_vertices[" << bundledVertices.size() << "] = {\n";
+
+    for(int i = 0; i < bundledVertices.size(); i++){
+        out << "(Vertex){vec3f(" << bundledVertices[i].Position(0) << ", " << bundledVertices[i].Position(1) << ", " << bundledVertices[i].Position(2) << "),"
+            << "vec3f(" << bundledVertices[i].Normal(0) << ", " << bundledVertices[i].Normal(1) << ", " << bundledVertices[i].Normal(2) << "),"
+            << "vec2f(" << bundledVertices[i].UV(0) << ", " << bundledVertices[i].UV(1) << ")"
+            << "}," << std::endl;
+    }
+    out.seekp(-2, std::ios_base::end);
+    out << "};" << std::endl;
+
+    // write the indices to the file as an index array.
+    out << "extern const uint32_t " << sym << "_indices[" << bundledVertices.size() << "] = {";
+
+    // Simply write increasing numbers from 0 to the number of vertices
+    for(int i = 0; i < bundledVertices.size(); i++){
+        out << i << ", ";
+    }
+    out.seekp(-2, std::ios_base::end);
+
+    out << "};" << std::endl;
+}
+
+// Tables over all levels of a mesh from the full one down, so code using them doesn't depend
+// on how many levels the simplification produced
+void writeLevels(std::ofstream& out, const std::string& sym, const std::vector<std::string>& levels, const std::vector<size_t>& sizes){
+    out << "extern const uint32_t " << sym << "_lod_count = " << levels.size() << ";" << std::endl;
+
+    out << "extern const uint32_t " << sym << "_lod_sizes[] = {";
+    for(int i = 0; i < sizes.size(); i++) out << (i == 0 ? "" : ", ") << sizes[i];
+    out << "};" << std::endl;
+
+    out << "extern const Vertex* const " << sym << "_lod_vertices[] = {";
+    for(int i = 0; i < levels.size(); i++) out << (i == 0 ? "" : ", ") << levels[i] << "_vertices";
+    out << "};" << std::endl;
+
+    out << "extern const uint32_t* const " << sym << "_lod_indices[] = {";
+    for(int i = 0; i < levels.size(); i++) out << (i == 0 ? "" : ", ") << levels[i] << "_indices";
+    out << "};" << std::endl;
+}
+
 void convertOBJ(std::ifstream& in, std::ofstream& out, const char* sym){
     std::vector<vec3f> vertices;
     std::vector<vec3f> normals;
@@ -75,29 +305,43 @@ void convertOBJ(std::ifstream& in, std::ofstream& out, const char* sym){
         bundledVertices.push_back(vertex);
     }
 
-    // write the vertices to the file as a vertex array
     out << "#include \"rendering/mesh.h\"\n#include \"mathematics/vector.h\"\n\n";
-    out << "extern const Vertex " << sym  << "_vertices[" << bundledVertices.size() << "] = {\n";
+    writeMesh(out, sym, bundledVertices);
 
-    for(int i = 0; i < bundledVertices.size(); i++){
-        out << "(Vertex){vec3f(" << bundledVertices[i].Position.x() << ", " << bundledVertices[i].Position.y() << ", " << bundledVertices[i].Position.z() << "),"
-            << "vec3f(" << bundledVertices[i].Normal.x() << ", " << bundledVertices[i].Normal.y() << ", " << bundledVertices[i].Normal.z() << "),"
-            << "vec2f(" << bundledVertices[i].UV.x() << ", " << bundledVertices[i].UV.y() << ")"
-            << "}," << std::endl;
-    }
-    out.seekp(-2, std::ios_base::end);
-    out << "};" << std::endl;
+    // Merge the corners into wedges for the simplification
+    std::vector<vec3<float>> positions;
+    for(vec3f vertex : vertices) positions.push_back(vertex);
 
-    // write the indices to the file as an index array.
-    out << "extern const uint32_t " << sym << "_indices[" << vertexIndices.size() << "] = {";
+    std::vector<Wedge> wedges;
+    std::vector<int> indices;
 
-    // Simply write increasing numbers from 0 to the number of vertices
     for(int i = 0; i < vertexIndices.size(); i++){
-        out << i << ", ";
+        int wedge = 0;
+        while(wedge < wedges.size() && !(wedges[wedge].Position == vertexIndices[i] - 1 &&
+              memcmp(&wedges[wedge]._Vertex, &bundledVertices[i], sizeof(Vertex)) == 0)) wedge++;
+
+        if(wedge == wedges.size()) wedges.push_back((Wedge){bundledVertices[i], vertexIndices[i] - 1});
+        indices.push_back(wedge);
     }
-    out.seekp(-2, std::ios_base::end);
 
-    out << "};" << std::endl;
+    std::vector<std::string> levels = { sym };
+    std::vector<size_t> sizes = { bundledVertices.size() };
+
+    for(int level = 1; level <= LOD_COUNT && indices.size() / 3 >= LOD_MIN_POLYGONS; level++){
+        std::vector<int> simplified = simplify(wedges, positions, indices);
+        if(simplified.size() * 4 > indices.size() * 3) break;
+        indices = simplified;
+
+        std::vector<Vertex> lodVertices;
+        for(int wedge : indices) lodVertices.push_back(wedges[wedge]._Vertex);
+
+        std::cout << "Level of detail " << level << " has " << indices.size() / 3 << " polygons" << std::endl;
+        levels.push_back(std::string(sym) + "_lod" + std::to_string(level));
+        sizes.push_back(lodVertices.size());
+        writeMesh(out, levels.back(), lodVertices);
+    }
+
+    writeLevels(out, sym, levels, sizes);
 }
 
 void convertPNG(const char* path, std::ofstream& fout, const char* sym){
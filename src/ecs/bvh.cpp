@@ -0,0 +1,299 @@
+#include "ecs/bvh.h"
+
+// Leaves are grown by this fraction of their size on every side
+#define BVH_MARGIN 0.1f
+
+namespace {
+    float surfaceArea(const BoundingVolume& volume){
+        vec3<float> size = vec3<float>(volume.Max - volume.Min);
+        return 2 * (size(0) * size(1) + size(1) * size(2) + size(2) * size(0));
+    }
+
+    // Distance along the ray at which it enters the box, or a negative number if it misses it
+    float intersectRay(const BoundingVolume& volume, const vec3<float>& origin, const vec3<float>& direction){
+        float enter = 0;
+        float exit = INFINITY;
+
+        for(int i = 0; i < 3; i++){
+            float low = SCAST<float>(volume.Min(i));
+            float high = SCAST<float>(volume.Max(i));
+
+            if(direction(i) == 0){
+                if(origin(i) < low || origin(i) > high) return -1;
+                continue;
+            }
+
+            float t0 = (low - origin(i)) / direction(i);
+            float t1 = (high - origin(i)) / direction(i);
+
+            enter = max(enter, min(t0, t1));
+            exit = min(exit, max(t0, t1));
+        }
+
+        return enter <= exit ? enter : -1;
+    }
+};
+
+int BoundingVolumeHierarchy::Insert(Object& object, const BoundingVolume& volume){
+    int leaf = allocate();
+    Node& node = nodes[leaf];
+
+    node._Object = &object;
+    node.Volume = volume;
+    node.Bounds = fatten(volume.Transform(object.GetModelMatrix()));
+    node.Height = 0;
+    object.boundsUpdated = false;
+
+    insertLeaf(leaf);
+    return leaf;
+}
+
+void BoundingVolumeHierarchy::Remove(int leaf){
+    removeLeaf(leaf);
+    release(leaf);
+}
+
+void BoundingVolumeHierarchy::Update(){
+    for(size_t i = 0; i < nodes.size(); i++){
+        if(nodes[i].Height != 0) continue;
+
+        Object& object = *nodes[i]._Object;
+        if(!object.boundsUpdated && object.Parent == nullptr) continue;
+        object.boundsUpdated = false;
+
+        BoundingVolume bounds = nodes[i].Volume.Transform(object.GetModelMatrix());
+        if(nodes[i].Bounds.Contains(bounds)) continue;
+
+        removeLeaf(i);
+        nodes[i].Bounds = fatten(bounds);
+        insertLeaf(i);
+    }
+}
+
+Object* BoundingVolumeHierarchy::Raycast(vec3f origin, vec3f direction, float* distance){
+    if(root == -1) return nullptr;
+
+    vec3<float> o = vec3<float>(origin);
+    vec3<float> d = vec3<float>(direction);
+    Object* nearest = nullptr;
+    float nearestDistance = INFINITY;
+
+    stack.clear();
+    stack.push_back(root);
+
+    while(!stack.empty()){
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        float t = intersectRay(node.Bounds, o, d);
+        if(t < 0 || t >= nearestDistance) continue;
+
+        if(node.Left != -1){
+            stack.push_back(node.Left);
+            stack.push_back(node.Right);
+            continue;
+        }
+
+        if(!node._Object->Enabled) continue;
+
+        // The grown box only tells that the ray could hit the object
+        t = intersectRay(node.Volume.Transform(node._Object->GetModelMatrix()), o, d);
+        if(t < 0 || t >= nearestDistance) continue;
+
+        nearest = node._Object;
+        nearestDistance = t;
+    }
+
+    if(distance != nullptr) *distance = nearestDistance;
+    return nearest;
+}
+
+int BoundingVolumeHierarchy::allocate(){
+    if(freeNode == -1){
+        nodes.push_back(Node());
+        freeNode = nodes.size() - 1;
+        nodes[freeNode].Parent = -1;
+    }
+
+    int node = freeNode;
+    freeNode = nodes[node].Parent;
+
+    nodes[node].Parent = -1;
+    nodes[node].Left = -1;
+    nodes[node].Right = -1;
+    nodes[node].Height = 0;
+    nodes[node]._Object = nullptr;
+    return node;
+}
+
+void BoundingVolumeHierarchy::release(int node){
+    nodes[node].Parent = freeNode;
+    nodes[node].Height = -1;
+    freeNode = node;
+}
+
+BoundingVolume BoundingVolumeHierarchy::fatten(const BoundingVolume& volume){
+    vec3f margin = (volume.Max - volume.Min) * BVH_MARGIN;
+    return BoundingVolume(volume.Min - margin, volume.Max + margin);
+}
+
+// Walks down to the sibling that adds the least surface area to the tree, the area of a node
+// being proportional to the chance of a query entering it
+void BoundingVolumeHierarchy::insertLeaf(int leaf){
+    if(root == -1){
+        root = leaf;
+        nodes[leaf].Parent = -1;
+        return;
+    }
+
+    BoundingVolume bounds = nodes[leaf].Bounds;
+    int sibling = root;
+
+    while(nodes[sibling].Left != -1){
+        const Node& node = nodes[sibling];
+        float area = surfaceArea(node.Bounds);
+        float combined = surfaceArea(node.Bounds.Union(bounds));
+
+        // Cost of pairing the leaf with this node, and the part of it every node below inherits
+        float cost = 2 * combined;
+        float inherited = 2 * (combined - area);
+
+        float childCosts[2];
+        int children[2] = { node.Left, node.Right };
+
+        for(int i = 0; i < 2; i++){
+            const Node& child = nodes[children[i]];
+            float grown = surfaceArea(child.Bounds.Union(bounds));
+            childCosts[i] = inherited + (child.Left == -1 ? grown : grown - surfaceArea(child.Bounds));
+        }
+
+        if(cost < childCosts[0] && cost < childCosts[1]) break;
+        sibling = childCosts[0] < childCosts[1] ? children[0] : children[1];
+    }
+
+    int oldParent = nodes[sibling].Parent;
+    int parent = allocate();
+
+    nodes[parent].Parent = oldParent;
+    nodes[parent].Height = nodes[sibling].Height + 1;
+    nodes[parent].Left = sibling;
+    nodes[parent].Right = leaf;
+    nodes[sibling].Parent = parent;
+    nodes[leaf].Parent = parent;
+
+    if(oldParent == -1){
+        root = parent;
+    } else {
+        replaceChild(oldParent, sibling, parent);
+    }
+
+    refit(parent);
+}
+
+void BoundingVolumeHierarchy::removeLeaf(int leaf){
+    if(leaf == root){
+        root = -1;
+        return;
+    }
+
+    int parent = nodes[leaf].Parent;
+    int grandParent = nodes[parent].Parent;
+    int sibling = nodes[parent].Left == leaf ? nodes[parent].Right : nodes[parent].Left;
+
+    nodes[sibling].Parent = grandParent;
+    release(parent);
+
+    if(grandParent == -1){
+        root = sibling;
+    } else {
+        replaceChild(grandParent, parent, sibling);
+        refit(grandParent);
+    }
+}
+
+// Balances the node and every node above it and updates their bounds and heights
+void BoundingVolumeHierarchy::refit(int node){
+    while(node != -1){
+        node = balance(node);
+        refresh(node);
+
+        node = nodes[node].Parent;
+    }
+}
+
+// Rotates the taller child up if the heights of the children differ by more than one.
+// Returns the node that took the place of the node. Only the heights of the children are
+// read, the node that took its place is refreshed by the caller.
+int BoundingVolumeHierarchy::balance(int node){
+    const Node& n = nodes[node];
+    if(n.Left == -1) return node;
+
+    int difference = nodes[n.Right].Height - nodes[n.Left].Height;
+
+    if(difference > 1) return rotate(node, n.Right);
+    if(difference < -1) return rotate(node, n.Left);
+    return node;
+}
+
+// The child takes the place of the node, which in turn takes the place of the shorter
+// child of the child
+int BoundingVolumeHierarchy::rotate(int node, int child){
+    int left = nodes[child].Left;
+    int right = nodes[child].Right;
+    int shorter = nodes[left].Height > nodes[right].Height ? right : left;
+    int parent = nodes[node].Parent;
+
+    nodes[child].Parent = parent;
+    if(parent == -1){
+        root = child;
+    } else {
+        replaceChild(parent, node, child);
+    }
+
+    replaceChild(node, child, shorter);
+    nodes[shorter].Parent = node;
+    replaceChild(child, shorter, node);
+    nodes[node].Parent = child;
+
+    // A leaf paired with a much taller subtree leaves the node leaning towards the part of
+    // that subtree it was given, so it is balanced as well
+    refresh(balance(node));
+
+    return child;
+}
+
+void BoundingVolumeHierarchy::refresh(int node){
+    Node& n = nodes[node];
+    n.Height = 1 + max(nodes[n.Left].Height, nodes[n.Right].Height);
+    n.Bounds = nodes[n.Left].Bounds.Union(nodes[n.Right].Bounds);
+}
+
+bool BoundingVolumeHierarchy::Validate(){
+    for(size_t i = 0; i < nodes.size(); i++){
+        const Node& n = nodes[i];
+        if(n.Height == -1) continue;
+
+        if(n.Left == -1){
+            if(!n.Bounds.Contains(n.Volume.Transform(n._Object->GetModelMatrix()))) return false;
+            continue;
+        }
+
+        const Node& left = nodes[n.Left];
+        const Node& right = nodes[n.Right];
+
+        if(left.Parent != SCAST<int>(i) || right.Parent != SCAST<int>(i)) return false;
+        if(n.Height != 1 + max(left.Height, right.Height)) return false;
+        if(left.Height - right.Height > 1 || right.Height - left.Height > 1) return false;
+        if(!n.Bounds.Contains(left.Bounds) || !n.Bounds.Contains(right.Bounds)) return false;
+    }
+
+    return true;
+}
+
+void BoundingVolumeHierarchy::replaceChild(int parent, int child, int replacement){
+    if(nodes[parent].Left == child){
+        nodes[parent].Left = replacement;
+    } else {
+        nodes[parent].Right = replacement;
+    }
+}
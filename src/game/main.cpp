@@ -10,16 +10,23 @@
 #include "rendering/mesh.h"
 #include "rendering/renderer.h"
 #include "rendering/postprocessing.h"
+#include "rendering/impostor.h"
 #include "hardware/input.h"
 #include "ecs/object.h"
+#include "ecs/bvh.h"
 
 #include "game/shaders.h"
 
-extern const Vertex sphere_obj_vertices[1080];
-extern const uint32_t sphere_obj_indices[1080];
+// Levels of detail generated by the resource embedder, the full mesh first
+extern const Vertex* const sphere_obj_lod_vertices[];
+extern const uint32_t* const sphere_obj_lod_indices[];
+extern const uint32_t sphere_obj_lod_sizes[];
+extern const uint32_t sphere_obj_lod_count;
 
-extern const Vertex suzanne_obj_vertices[2904];
-extern const uint32_t suzanne_obj_indices[2904];
+extern const Vertex* const suzanne_obj_lod_vertices[];
+extern const uint32_t* const suzanne_obj_lod_indices[];
+extern const uint32_t suzanne_obj_lod_sizes[];
+extern const uint32_t suzanne_obj_lod_count;
 
 extern const Color16 mercury_png[80000];
 extern const Color16 venus_png[80000];
@@ -44,6 +51,7 @@ struct Body : public Object {
     bool Render = true;
     vec3<float> D;
     char Name[32];
+    Impostor _Impostor;
 };
 
 Vertex quadVerts[] = {
@@ -61,8 +69,8 @@ uint32_t quadIndices[] = {
 Mesh quad = Mesh((Vertex*)&quadVerts, 4, (uint32_t*)&quadIndices, 2);
 
 Camera& cam = Renderer::MainCamera;
-Mesh sphere = Mesh((Vertex*)&sphere_obj_vertices, 1080, (uint32_t*)&sphere_obj_indices, 1080/3);
-Mesh suzanne = Mesh((Vertex*)&suzanne_obj_vertices, 2904, (uint32_t*)&suzanne_obj_indices, 2904/3);
+Mesh& sphere = Mesh::FromLevels(sphere_obj_lod_vertices, sphere_obj_lod_indices, sphere_obj_lod_sizes, sphere_obj_lod_count);
+Mesh& suzanne = Mesh::FromLevels(suzanne_obj_lod_vertices, suzanne_obj_lod_indices, suzanne_obj_lod_sizes, suzanne_obj_lod_count);
 
 Texture2D mercury = Texture2D((Color16*)&mercury_png, 400, 200);
 Texture2D venus = Texture2D((Color16*)&venus_png, 400, 200);
@@ -85,6 +93,7 @@ FlatLightingShader l = FlatLightingShader();
 SmoothLightingShader s = SmoothLightingShader();
 
 Body planets[10];
+BoundingVolumeHierarchy scene;
 
 fixed yaw, pitch;
 
@@ -288,6 +297,10 @@ void game_init(){
         }
     }
 
+    for(Body& planet : planets){
+        if(planet.Render) scene.Insert(planet, sphere.Volume);
+    }
+
     PostProcessing::Bloom* bloom = new PostProcessing::Bloom();
 
     PostProcessing::Colorize* colorize = new PostProcessing::Colorize(new Color[6]{
@@ -383,6 +396,14 @@ void game_update(){
         while(!planets[(++targetPlanet%=10)].Enabled);
     }
 
+    // Picks the planet behind the target in the middle of the screen, the ray starts past the target
+    if(Input::GetButtonPress(Input::Button::C)){
+        Body& target = planets[targetPlanet];
+        Object* picked = scene.Raycast(target.GetPosition() + camForward * target.GetScale().x() * 2, camForward);
+
+        if(picked != nullptr) targetPlanet = static_cast<Body*>(picked) - planets;
+    }
+
     if(Input::GetButtonDown(Input::Button::A)){
         targetCamDistance = clamp(targetCamDistance - 0.05fp, 1.1fp, 20fp);
     }
@@ -396,6 +417,17 @@ void game_update(){
     cam.SetPosition(planets[targetPlanet].GetPosition() - camForward * camDistance * planets[targetPlanet].GetScale().x());
 }
 
+void submitPlanet(Body& planet){
+    fixed dst = (planet.GetPosition() - cam.GetPosition()).magnitude();
+
+    // Only planets close to the camera span enough depth for affine texture warping to show
+    Interpolation interpolation = dst < planet.GetScale().x() * 10fp ? Interpolation::Perspective : Interpolation::Affine;
+
+    // Planet textures are low frequency at this resolution, only their edges need the full shading rate
+    Renderer::Submit(DrawCall(sphere, planet.GetModelMatrix(), *planet._Material, Culling::Back, DepthTest::Less, interpolation,
+                              Rasterization::HalfSpace, ShadingRate::Rate2x2));
+}
+
 void game_mesh_render(){
     // static TextureShader t = TextureShader();
     // static Material starsMat = Material(t);
@@ -414,14 +446,31 @@ void game_mesh_render(){
         Renderer::Blit(flare, vec2i16(sunPos.xy()) - vec2i16(flare.Width, flare.Height) / 2);
     }
     
-    for(Body& planet : planets){
-        if(!planet.Enabled || !planet.Render) continue;
+    // Planets are visited from front to back, so the large ones close to the camera can hide the ones behind them.
+    // Planets only a few pixels across are drawn from images, of which just the most outdated are rendered again.
+    scene.Update();
 
-        fixed dst = (planet.GetPosition() - cam.GetPosition()).magnitude();
+    Body* impostors[sizeof(planets)/sizeof(Body)];
+    int impostorCount = 0;
+
+    scene.Query(Renderer::MainContext, [&](Object& object){
+        Body& planet = static_cast<Body&>(object);
+        if(!planet.Render) return;
+
+        vec3f directionToLight = (planets[0].GetPosition() - planet.GetPosition()).normalize();
+
+        if(planet._Impostor.Update(sphere, planet.GetModelMatrix(), *planet._Material, directionToLight)){
+            impostors[impostorCount++] = &planet;
+            return;
+        }
+
+        submitPlanet(planet);
+    });
 
-        // if(dst > 200) continue;
+    Impostor::RenderQueued();
 
-        Renderer::Submit(DrawCall(sphere, planet.GetModelMatrix(), *planet._Material));
+    for(int i = 0; i < impostorCount; i++){
+        if(!impostors[i]->_Impostor.Draw()) submitPlanet(*impostors[i]);
     }
 }
 
@@ -0,0 +1,162 @@
+#include <cstring>
+#include "rendering/impostor.h"
+
+// Half of the field of view images are rendered with. The smaller it is, the closer the
+// perspective of the image gets to the one of the mesh seen from far away.
+#define IMPOSTOR_HALF_ANGLE 5.0f
+// Images are rendered again once one of the directions changed by more than this many degrees
+#define IMPOSTOR_MAX_ANGLE  3.0f
+
+namespace {
+    RenderTarget* target = nullptr;
+
+    Impostor* queue[RENDER_IMPOSTOR_BUDGET];
+    float queueErrors[RENDER_IMPOSTOR_BUDGET];
+    int queueLength = 0;
+
+    // Keeps the impostors with the largest errors
+    void enqueue(Impostor* impostor, float error){
+        if(queueLength < RENDER_IMPOSTOR_BUDGET){
+            queue[queueLength] = impostor;
+            queueErrors[queueLength] = error;
+            queueLength++;
+            return;
+        }
+
+        int smallest = 0;
+        for(int i = 1; i < queueLength; i++){
+            if(queueErrors[i] < queueErrors[smallest]) smallest = i;
+        }
+
+        if(error > queueErrors[smallest]){
+            queue[smallest] = impostor;
+            queueErrors[smallest] = error;
+        }
+    }
+
+    // Transforms a world space direction into object space, which the transpose does as long as
+    // the model matrix is only scaled uniformly
+    vec3<float> toObjectSpace(const mat4f& modelMat, vec3f direction){
+        vec3<float> d = vec3<float>(direction);
+
+        return vec3<float>(
+            vec3<float>(modelMat.col(0).xyz()) * d,
+            vec3<float>(modelMat.col(1).xyz()) * d,
+            vec3<float>(modelMat.col(2).xyz()) * d
+        ).normalize();
+    }
+
+    fixed boundingRadius(const Mesh& mesh){
+        vec3<float> center = vec3<float>((mesh.Volume.Min + mesh.Volume.Max) / 2);
+        float radius = 0;
+
+        for(uint32_t i = 0; i < mesh.VertexCount; i++){
+            vec3<float> offset = vec3<float>(mesh.Vertices[i].Position) - center;
+            radius = max(radius, offset * offset);
+        }
+
+        return sqrtf(radius);
+    }
+};
+
+Impostor::~Impostor(){
+    delete[] data;
+}
+
+bool Impostor::Update(const Mesh& mesh, const mat4f& modelMat, const Material& material, vec3f lightDirection){
+    if(&mesh != this->mesh){
+        this->mesh = &mesh;
+        meshRadius = boundingRadius(mesh);
+        valid = false;
+    }
+
+    this->material = &material;
+    this->modelMat = modelMat;
+
+    float scale = 0;
+    for(int i = 0; i < 3; i++){
+        vec3<float> axis = vec3<float>(modelMat.col(i).xyz());
+        scale = max(scale, axis * axis);
+    }
+
+    center = (modelMat * vec4f((mesh.Volume.Min + mesh.Volume.Max) / 2, 1)).xyz();
+    radius = meshRadius * fixed(sqrtf(scale));
+
+    RenderContext& context = Renderer::MainContext;
+    vec3f cameraUp = Renderer::MainCamera.GetRotation().ToMatrix()(1).xyz();
+
+    vec3f screenCenter = (context.RVP * vec4f(center, 1)).homogenize();
+    vec3f screenTop = (context.RVP * vec4f(center + cameraUp * radius, 1)).homogenize();
+
+    if(screenCenter.z() <= 0 || screenCenter.z() >= 1) return false;
+    if((screenTop.xy() - screenCenter.xy()).magnitude() * 2 > RENDER_IMPOSTOR_SIZE) return false;
+
+    view = toObjectSpace(modelMat, center - context.EyePosition);
+    up = toObjectSpace(modelMat, cameraUp);
+    light = toObjectSpace(modelMat, lightDirection);
+
+    if(!valid){
+        enqueue(this, 2);
+        return true;
+    }
+
+    float error = max(1 - view * imageView, max(1 - up * imageUp, 1 - light * imageLight));
+
+    if(error > 1 - cosf(IMPOSTOR_MAX_ANGLE / 180.0f * PI)){
+        enqueue(this, error);
+    }
+
+    return true;
+}
+
+bool Impostor::Draw(){
+    if(!valid) return false;
+
+    Renderer::DrawBillboard(Texture2D(data, RENDER_IMPOSTOR_SIZE, RENDER_IMPOSTOR_SIZE), center, extent);
+    return true;
+}
+
+void Impostor::RenderQueued(){
+    for(int i = 0; i < queueLength; i++){
+        queue[i]->render();
+    }
+
+    queueLength = 0;
+}
+
+// Renders the mesh from the direction the main camera sees it from, keeping the roll of the
+// main camera so the image can be drawn upright on the screen.
+void Impostor::render(){
+    if(target == nullptr){
+        target = new RenderTarget(vec2i16(RENDER_IMPOSTOR_SIZE, RENDER_IMPOSTOR_SIZE), ColorFormat::RGBA4444);
+    }
+
+    if(data == nullptr){
+        data = new Color16[RENDER_IMPOSTOR_SIZE * RENDER_IMPOSTOR_SIZE];
+    }
+
+    float halfAngle = IMPOSTOR_HALF_ANGLE / 180.0f * PI;
+    float distance = SCAST<float>(radius) / sinf(halfAngle);
+
+    vec3<float> forward = vec3<float>(center - Renderer::MainContext.EyePosition).normalize();
+    vec3<float> cameraUp = vec3<float>(Renderer::MainCamera.GetRotation().ToMatrix()(1).xyz());
+
+    Camera camera = Camera(fixed(IMPOSTOR_HALF_ANGLE * 2), fixed(distance) - radius * 1.5fp, fixed(distance) + radius * 1.5fp);
+    camera.SetPosition(center - vec3f(forward * distance));
+    camera.SetRotation(Quaternion::LookRotation(forward, cameraUp));
+
+    RenderContext context = RenderContext(*target, camera);
+    context.Update();
+
+    target->Clear(Color(0, 0, 0, 0));
+    Renderer::DrawMesh(context, *mesh, modelMat, *material);
+    target->Resolve();
+
+    memcpy(data, target->TextureData, sizeof(Color16) * RENDER_IMPOSTOR_SIZE * RENDER_IMPOSTOR_SIZE);
+
+    imageView = view;
+    imageUp = up;
+    imageLight = light;
+    extent = fixed(SCAST<float>(radius) / cosf(halfAngle));
+    valid = true;
+}
@@ -1,157 +1,2445 @@
 #include "rendering/renderer.h"
 
+#include <new>
+#include <string.h>
+#include <type_traits>
+
 extern const uint8_t font_psf[];
 
-Camera Renderer::MainCamera = Camera(45fp, 0.1fp, 500fp, FRAME_WIDTH / FRAME_HEIGHT);
-Color565 Renderer::FrameBuffer[FRAME_WIDTH * FRAME_HEIGHT];
-uint16_t Renderer::Zbuffer[FRAME_WIDTH * FRAME_HEIGHT];
-Font Renderer::TextFont = Font((uint8_t*)&font_psf);
+Camera Renderer::MainCamera = Camera(45fp, 0.1fp, 500fp, FRAME_WIDTH / FRAME_HEIGHT);
+static_assert(RENDER_FRAME_BUFFER_COUNT >= 2, "The frame being presented must not be the one rendered into");
+
+Color565 frameBuffers[RENDER_FRAME_BUFFER_COUNT][FRAME_WIDTH * FRAME_HEIGHT];
+uint16_t zBuffer[FRAME_WIDTH * FRAME_HEIGHT];
+RenderTarget Renderer::MainTarget = RenderTarget(vec2i16(FRAME_WIDTH, FRAME_HEIGHT), frameBuffers[0], zBuffer);
+RenderContext Renderer::MainContext = RenderContext(MainTarget, MainCamera);
+Font Renderer::TextFont = Font((uint8_t*)&font_psf);
+
+Color Renderer::ClearColor = Color::Black;
+Shading Renderer::ShadingMode = Shading::Forward;
+
+Camera::Camera(fixed fov, fixed near, fixed far, fixed aspect){
+    this->fov = fov;
+    this->near = near;
+    this->far = far;
+
+    projection = mat4f::perspective(fov, aspect, near, far);
+}
+
+mat4f Camera::GetViewMatrix(){
+    return rotation.ToMatrix() * mat4f::translate(-position);;
+}
+
+// Deferred draw calls are not rasterized as a whole. Submit projects every triangle
+// once and bins it into the screen tiles its bounding box overlaps. Workers then
+// claim whole tiles, so every pixel of the frame and depth buffer is only ever
+// touched by a single worker and triangles within a tile keep their submission order.
+namespace Renderer {
+namespace {
+    constexpr int tileCountX = (FRAME_WIDTH + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    constexpr int tileCountY = (FRAME_HEIGHT + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    constexpr int tileCount = tileCountX * tileCountY;
+    constexpr uint16_t binEnd = 0xFFFF;
+
+    // Resolution the main context is set to in the next Prepare. Upscale stretches its
+    // viewport over the whole frame.
+    vec2i16 nextResolution = vec2i16(FRAME_WIDTH, FRAME_HEIGHT);
+
+    struct BinnedTriangle {
+        const DrawCall* Call;
+        const Vertex *V1, *V2, *V3;
+        vec3f P1, P2, P3;
+        // Clip space w of every vertex, used for perspective correct interpolation
+        vec3f W;
+        Color TriangleColor;
+        int16_t MinX, MinY, MaxX, MaxY;
+    };
+
+    struct BinEntry {
+        uint16_t Triangle;
+        uint16_t Next;
+    };
+
+    // DrawCall holds references and can't be default constructed, so submitted calls
+    // are copied into raw storage that lives for the duration of the frame.
+    alignas(DrawCall) uint8_t drawCallStorage[DEFERRED_QUEUE_SIZE * sizeof(DrawCall)];
+    DrawCall* drawCalls = (DrawCall*)drawCallStorage;
+    int drawCallCount = 0;
+
+    BinnedTriangle triangles[RENDER_TRIANGLE_CAPACITY];
+    int triangleCount = 0;
+
+    BinEntry binEntries[RENDER_BIN_CAPACITY];
+    int binEntryCount = 0;
+
+    uint16_t binHead[tileCount];
+    uint16_t binTail[tileCount];
+
+    bool binOverflow = false;
+
+    // Clip space position of a vertex together with the attributes it carries. Vertices
+    // created by clipping are allocated from a VertexPool, all others point into the mesh.
+    struct ClipVertex {
+        vec4f Position;
+        const Vertex* Source;
+    };
+
+    struct VertexPool {
+        Vertex* Vertices;
+        int Count;
+        int Capacity;
+
+        FORCE_INLINE Vertex* Allocate(){
+            return Count < Capacity ? &Vertices[Count++] : nullptr;
+        }
+    };
+
+    Vertex clipVertices[RENDER_CLIP_VERTEX_CAPACITY];
+    VertexPool clipVertexPool = { clipVertices, 0, RENDER_CLIP_VERTEX_CAPACITY };
+
+    // Near, far, left, right, top and bottom. Every plane a triangle is clipped against
+    // adds at most one vertex to the polygon, but may allocate two new ones.
+    constexpr int clipPlaneCount = 6;
+    constexpr int clipPolygonCapacity = 3 + clipPlaneCount;
+    constexpr int clipTriangleCapacity = clipPolygonCapacity - 2;
+    constexpr int clipVertexCapacity = 2 * clipPlaneCount;
+
+    // Signed distance of a clip space position to a clip plane, positive on the inside.
+    // Visible points have a negative w, so the usual inequalities are flipped. The x and
+    // y planes are pushed out of the frame by the guard band.
+    FORCE_INLINE fixed clipDistance(RenderContext& context, const vec4f& v, int plane, fixed guardBand){
+        switch(plane){
+            case 0: return -v(2);
+            case 1: return v(2) - v(3);
+            case 2: return -guardBand * v(3) - v(0);
+            case 3: return v(0) - (guardBand + context.Resolution.x()) * v(3);
+            case 4: return -guardBand * v(3) - v(1);
+            default: return v(1) - (guardBand + context.Resolution.y()) * v(3);
+        }
+    }
+
+    FORCE_INLINE uint8_t clipOutcode(RenderContext& context, const vec4f& v, fixed guardBand){
+        uint8_t code = 0;
+
+        for(int plane = 0; plane < clipPlaneCount; plane++){
+            if(clipDistance(context, v, plane, guardBand) < 0fp) code |= 1 << plane;
+        }
+
+        return code;
+    }
+
+    // Clips a convex polygon against a single plane (Sutherland-Hodgman). Attributes are
+    // linear in clip space, so new vertices simply interpolate them. Returns the vertex
+    // count of the clipped polygon, which is 0 if nothing is left or the pool is full.
+    int clipPolygon(RenderContext& context, const ClipVertex* in, int count, ClipVertex* out, int plane, VertexPool& pool){
+        int outCount = 0;
+
+        const ClipVertex* prev = &in[count - 1];
+        fixed prevDistance = clipDistance(context, prev->Position, plane, RENDER_GUARD_BAND);
+
+        for(int i = 0; i < count; i++){
+            const ClipVertex* cur = &in[i];
+            fixed curDistance = clipDistance(context, cur->Position, plane, RENDER_GUARD_BAND);
+
+            if((prevDistance >= 0fp) != (curDistance >= 0fp)){
+                Vertex* v = pool.Allocate();
+                if(v == nullptr) return 0;
+
+                // Edges are always walked from the inside out, so neighbouring triangles
+                // sharing a clipped edge get bit identical vertices and no cracks.
+                const ClipVertex* inside = prevDistance >= 0fp ? prev : cur;
+                const ClipVertex* outside = prevDistance >= 0fp ? cur : prev;
+                fixed insideDistance = prevDistance >= 0fp ? prevDistance : curDistance;
+                fixed outsideDistance = prevDistance >= 0fp ? curDistance : prevDistance;
+
+                fixed t = insideDistance / (insideDistance - outsideDistance);
+                const Vertex& a = *inside->Source;
+                const Vertex& b = *outside->Source;
+
+                *v = {
+                    a.Position + (b.Position - a.Position) * t,
+                    a.Normal + (b.Normal - a.Normal) * t,
+                    a.UV + (b.UV - a.UV) * t
+                };
+
+                out[outCount++] = { inside->Position + (outside->Position - inside->Position) * t, v };
+            }
+
+            if(curDistance >= 0fp) out[outCount++] = *cur;
+
+            prev = cur;
+            prevDistance = curDistance;
+        }
+
+        return outCount;
+    }
+
+    constexpr int subpixel = 1 << RENDER_SUBPIXEL_BITS;
+
+    // Rounds a screen space position to the sub-pixel grid the edge functions work on.
+    FORCE_INLINE vec2<int> snapToSubpixel(const vec3f& p){
+        constexpr int shift = FIXED_32_FRAC_BITS - RENDER_SUBPIXEL_BITS;
+        return vec2<int>((p(0).value + (1 << (shift - 1))) >> shift,
+                         (p(1).value + (1 << (shift - 1))) >> shift);
+    }
+
+    // Top-left fill rule. A pixel center exactly on an edge only belongs to the triangle
+    // if it's a left edge or a horizontal top edge, so pixels on an edge shared by two
+    // triangles are drawn exactly once. Applied as a bias on the edge function.
+    FORCE_INLINE int topLeftBias(int a, int b){
+        return (a > 0 || (a == 0 && b > 0)) ? 0 : -1;
+    }
+
+    // Used in place of a shader type by passes that don't shade
+    struct DepthOnly {};
+    struct WriteTriangleId {};
+
+    // Unregistered shaders fall back to the dispatch by ID, the base shader can't be
+    // instantiated. Depth passes don't need the results of the triangle program.
+    template<typename S>
+    FORCE_INLINE void runTriangleProgram(Shader& shader, TriangleShaderData& data, void* parameters){
+        if constexpr(std::is_same_v<S, DepthOnly>) return;
+        else if constexpr(std::is_same_v<S, Shader>) executeTriangleProgram(shader, data, parameters);
+        else ((S)shader).TriangleProgram(data, parameters);
+    }
+
+    template<typename S>
+    FORCE_INLINE void runFragmentProgram(Shader& shader, FragmentShaderData& data, void* parameters){
+        if constexpr(std::is_same_v<S, Shader>) executeFragmentProgram(shader, data, parameters);
+        else ((S)shader).FragmentProgram(data, parameters);
+    }
+
+    // The camera position in the object space of a draw call, polygons facing away from
+    // it are culled before any of their vertices are transformed.
+    struct ModelEye {
+        vec3f Position;
+        // Mirroring model matrices flip the winding of every polygon on screen
+        bool Mirrored;
+    };
+
+    // Polygons this close to edge on are left to the screen space test, the face planes
+    // are not precise enough to agree with the snapped winding.
+    constexpr fixed facingEpsilon = 0.0625fp;
+
+    // Diameter in pixels of the bounding sphere of a volume at its distance from the eye, which unlike
+    // its depth doesn't change when the camera turns. Calculated with floats like toModelSpace.
+    int projectedSize(RenderContext& context, const BoundingVolume& volume, const mat4f& modelMat){
+        vec3<float> center = vec3<float>((volume.Min + volume.Max) / 2);
+        vec3<float> extent = vec3<float>(volume.Max - volume.Min) / 2;
+        vec3<float> offset;
+        float scale = 0;
+
+        for(int r = 0; r < 3; r++){
+            vec3<float> axis = vec3<float>(SCAST<float>(modelMat(0, r)), SCAST<float>(modelMat(1, r)), SCAST<float>(modelMat(2, r)));
+            scale = max(scale, axis * axis);
+
+            offset[r] = SCAST<float>(modelMat(r, 0)) * center(0) + SCAST<float>(modelMat(r, 1)) * center(1) +
+                        SCAST<float>(modelMat(r, 2)) * center(2) + SCAST<float>(modelMat(r, 3)) - SCAST<float>(context.EyePosition(r));
+        }
+
+        float radius = sqrtf(extent * extent * scale);
+        float distance = sqrtf(offset * offset);
+
+        if(distance <= radius) return INT16_MAX;
+
+        float size = radius * SCAST<float>(context._Camera.GetProjectionMatrix()(1, 1)) * context.Resolution.y() / distance;
+        return SCAST<int>(min(size, SCAST<float>(INT16_MAX)));
+    }
+
+    // Only runs once per draw call, so the upper 3x3 of the model matrix is inverted with floats.
+    // Fixed point overflows for the scales models are usually drawn with.
+    ModelEye toModelSpace(RenderContext& context, const mat4f& modelMat){
+        float a[3][3];
+        float e[3];
+
+        for(int r = 0; r < 3; r++){
+            for(int c = 0; c < 3; c++){
+                a[r][c] = SCAST<float>(modelMat(r, c));
+            }
+            e[r] = SCAST<float>(context.EyePosition(r)) - SCAST<float>(modelMat(r, 3));
+        }
+
+        float inv[3][3] = {
+            { a[1][1] * a[2][2] - a[1][2] * a[2][1], a[0][2] * a[2][1] - a[0][1] * a[2][2], a[0][1] * a[1][2] - a[0][2] * a[1][1] },
+            { a[1][2] * a[2][0] - a[1][0] * a[2][2], a[0][0] * a[2][2] - a[0][2] * a[2][0], a[0][2] * a[1][0] - a[0][0] * a[1][2] },
+            { a[1][0] * a[2][1] - a[1][1] * a[2][0], a[0][1] * a[2][0] - a[0][0] * a[2][1], a[0][0] * a[1][1] - a[0][1] * a[1][0] },
+        };
+
+        float det = a[0][0] * inv[0][0] + a[0][1] * inv[1][0] + a[0][2] * inv[2][0];
+
+        // A degenerate matrix flattens the mesh, there is nothing to cull in object space
+        if(det == 0) return { vec3f(0), false };
+
+        vec3f position;
+        for(int r = 0; r < 3; r++){
+            position[r] = (inv[r][0] * e[0] + inv[r][1] * e[1] + inv[r][2] * e[2]) / det;
+        }
+
+        return { position, det < 0 };
+    }
+
+    // Homogenizes a clipped triangle and prepares it for rasterization. Returns false if
+    // the triangle is culled, degenerate or doesn't overlap the frame.
+    template<Culling CullingMode>
+    bool setupTriangle(RenderContext& context, const ClipVertex* c1, const ClipVertex* c2, const ClipVertex* c3, BinnedTriangle& out){
+        vec3f pv1 = c1->Position.homogenize();
+        vec3f pv2 = c2->Position.homogenize();
+        vec3f pv3 = c3->Position.homogenize();
+
+        BoundingBox2D bb = BoundingBox2D::FromTriangle(pv1.xy(), pv2.xy(), pv3.xy());
+        BoundingBox2D bbi = context.Bounds.Intersect(bb);
+
+        if(bbi.IsEmpty()) return false;
+
+#ifdef RENDER_DEBUG_TRIANGLE_BOUNDING
+        Renderer::DrawBorder(bbi, 1, Color::Yellow);
+#endif
+
+        // TODO: this doesn't properly render because the drawing of other triangles
+        //       will overwrite the debug drawings
+#ifdef RENDER_DEBUG_WIREFRAME
+        Renderer::DrawLine(vec2i16(SCAST<int>(pv1.x()), SCAST<int>(pv1.y())), vec2i16(SCAST<int>(pv2.x()), SCAST<int>(pv2.y())), Color::Cyan);
+        Renderer::DrawLine(vec2i16(SCAST<int>(pv2.x()), SCAST<int>(pv2.y())), vec2i16(SCAST<int>(pv3.x()), SCAST<int>(pv3.y())), Color::Cyan);
+        Renderer::DrawLine(vec2i16(SCAST<int>(pv3.x()), SCAST<int>(pv3.y())), vec2i16(SCAST<int>(pv1.x()), SCAST<int>(pv1.y())), Color::Cyan);
+#endif
+
+        vec2<int> v1 = snapToSubpixel(pv1);
+        vec2<int> v2 = snapToSubpixel(pv2);
+        vec2<int> v3 = snapToSubpixel(pv3);
+
+        // The winding is taken from the same snapped coordinates the edge functions are
+        // evaluated with, front faces have a positive area.
+        int area = edgeFunctionFast(v1, v2, v3);
+
+        if(area == 0) return false;
+
+        switch(CullingMode){
+            case Culling::None:
+                break;
+            case Culling::Front:
+                if(area > 0) return false;
+                break;
+            case Culling::Back:
+                if(area < 0) return false;
+                break;
+        }
+
+        // The rasterizer only accepts a positive area, back faces that made it
+        // this far get their winding flipped.
+        if(area < 0){
+            const ClipVertex* c = c2;
+            c2 = c3;
+            c3 = c;
+
+            vec3f pv = pv2;
+            pv2 = pv3;
+            pv3 = pv;
+        }
+
+        out.V1 = c1->Source;
+        out.V2 = c2->Source;
+        out.V3 = c3->Source;
+        out.P1 = pv1;
+        out.P2 = pv2;
+        out.P3 = pv3;
+        out.W = vec3f(c1->Position(3), c2->Position(3), c3->Position(3));
+        out.MinX = SCAST<int16_t>(floor(bbi.Min.x()));
+        out.MinY = SCAST<int16_t>(floor(bbi.Min.y()));
+        out.MaxX = SCAST<int16_t>(ceil(bbi.Max.x()));
+        out.MaxY = SCAST<int16_t>(ceil(bbi.Max.y()));
+
+        return true;
+    }
+
+    // Projects a single polygon to screen space and runs the triangle program if any part of
+    // it is visible. Polygons facing the culled side are rejected in object space first, the
+    // rest is rejected against the frame before clipping. Only triangles crossing the near or
+    // far plane or reaching past the guard band are clipped, new vertices are taken from the
+    // pool. Returns the number of triangles written to out, which is 0 if the polygon is culled
+    // or outside the frame.
+    template<typename S, Culling CullingMode>
+    int projectTriangle(RenderContext& context, const Mesh& mesh, uint32_t polygon, const mat4f& modelMat, const mat4f& rMVP, const ModelEye& eye,
+                        const Material& material, VertexPool& pool, BinnedTriangle (&out)[clipTriangleCapacity]){
+        if constexpr(CullingMode != Culling::None){
+            const vec4f& plane = mesh.FacePlanes[polygon];
+            fixed distance = plane.xyz() * eye.Position - plane(3);
+            if(eye.Mirrored) distance = -distance;
+
+            if(CullingMode == Culling::Back && distance < -facingEpsilon) return 0;
+            if(CullingMode == Culling::Front && distance > facingEpsilon) return 0;
+        }
+
+        uint32_t idx = polygon * 3;
+
+        const Vertex& V1 = mesh.Vertices[mesh.Indices[idx]];
+        const Vertex& V2 = mesh.Vertices[mesh.Indices[idx+1]];
+        const Vertex& V3 = mesh.Vertices[mesh.Indices[idx+2]];
+
+        ClipVertex clipped[2][clipPolygonCapacity];
+        clipped[0][0] = { rMVP * vec4f(V1.Position, 1), &V1 };
+        clipped[0][1] = { rMVP * vec4f(V2.Position, 1), &V2 };
+        clipped[0][2] = { rMVP * vec4f(V3.Position, 1), &V3 };
+
+        // Triangles entirely outside of one of the planes of the frame
+        if(clipOutcode(context, clipped[0][0].Position, 0fp) &
+           clipOutcode(context, clipped[0][1].Position, 0fp) &
+           clipOutcode(context, clipped[0][2].Position, 0fp)) return 0;
+
+        uint8_t planes = clipOutcode(context, clipped[0][0].Position, RENDER_GUARD_BAND) |
+                         clipOutcode(context, clipped[0][1].Position, RENDER_GUARD_BAND) |
+                         clipOutcode(context, clipped[0][2].Position, RENDER_GUARD_BAND);
+
+        int count = 3;
+        int current = 0;
+
+        for(int plane = 0; plane < clipPlaneCount && planes != 0; plane++){
+            if(!(planes & (1 << plane))) continue;
+
+            count = clipPolygon(context, clipped[current], count, clipped[1 - current], plane, pool);
+            current = 1 - current;
+
+            if(count < 3) return 0;
+        }
+
+        int emitted = 0;
+
+        for(int i = 1; i + 1 < count; i++){
+            if(setupTriangle<CullingMode>(context, &clipped[current][0], &clipped[current][i], &clipped[current][i + 1], out[emitted])) emitted++;
+        }
+
+        if(emitted == 0) return 0;
+
+        TriangleShaderData t = {
+            V1, V2, V3,
+            modelMat,
+            Color::Purple
+        };
+
+        runTriangleProgram<S>(material._Shader, t, material.Parameters);
+
+#ifdef RENDER_DEBUG_FACE_NORMALS
+        vec3f pos = (t.V1.Position + t.V2.Position + t.V3.Position) / 3;
+        pos = (modelMat * vec4f(pos, 1)).homogenize();
+
+        vec3f normal = (t.V2.Position - t.V1.Position).cross(t.V3.Position - t.V1.Position).normalize();
+        normal = (modelMat * vec4f(normal, 0)).xyz().normalize();
+
+        Renderer::DrawLine(pos, pos + normal, Color::White);
+#endif
+
+        for(int i = 0; i < emitted; i++){
+            out[i].TriangleColor = t.TriangleColor;
+        }
+
+        return emitted;
+    }
+
+    enum Varying {
+        U, V,
+        NormalX, NormalY, NormalZ,
+        VaryingCount
+    };
+
+    FORCE_INLINE void setupVaryings(const Vertex& v1, const Vertex& v2, const Vertex& v3, vec3f weights,
+                                    const Interpolant& b2, const Interpolant& b3, Interpolant (&out)[VaryingCount]){
+        out[U] = Interpolant::FromWeights(v1.UV(0) * weights(0), v2.UV(0) * weights(1), v3.UV(0) * weights(2), b2, b3);
+        out[V] = Interpolant::FromWeights(v1.UV(1) * weights(0), v2.UV(1) * weights(1), v3.UV(1) * weights(2), b2, b3);
+        out[NormalX] = Interpolant::FromWeights(v1.Normal(0) * weights(0), v2.Normal(0) * weights(1), v3.Normal(0) * weights(2), b2, b3);
+        out[NormalY] = Interpolant::FromWeights(v1.Normal(1) * weights(0), v2.Normal(1) * weights(1), v3.Normal(1) * weights(2), b2, b3);
+        out[NormalZ] = Interpolant::FromWeights(v1.Normal(2) * weights(0), v2.Normal(2) * weights(1), v3.Normal(2) * weights(2), b2, b3);
+    }
+
+    // Divides the 1/w weighted varying planes by the 1/w plane at the current position.
+    // The reciprocal is taken once and shared by all varyings. Both planes carry
+    // 12 + INTERPOLANT_FRAC_BITS fractional bits, so they're reduced by 16 bits first to
+    // keep the products within 64 bits. The result is in the units of a linear Interpolant.
+    FORCE_INLINE void perspectiveDivide(const Interpolant (&projected)[VaryingCount], const Interpolant& q, int64_t (&out)[VaryingCount]){
+        int64_t reciprocal = ((int64_t)1 << 40) / max(q.Value >> 16, (int64_t)1);
+
+        for(int i = 0; i < VaryingCount; i++){
+            out[i] = ((projected[i].Value >> 16) * reciprocal) >> 4;
+        }
+    }
+
+    // Sets up the varyings of a triangle from the weights of its second and third vertex.
+    // With perspective interpolation these are the varyings divided by w instead, and q
+    // is set to the plane of 1/w. Returns whether perspective interpolation is used.
+    bool setupAttributes(const BinnedTriangle& tri, Interpolation interpolationMode, const Interpolant& b2,
+                         const Interpolant& b3, Interpolant (&varyings)[VaryingCount], Interpolant& q){
+        // The projection maps visible points to a negative w. Triangles with vertices on
+        // both sides of the camera plane fall back to affine interpolation.
+        bool perspective = interpolationMode == Interpolation::Perspective &&
+                           ((tri.W(0) > 0fp && tri.W(1) > 0fp && tri.W(2) > 0fp) ||
+                            (tri.W(0) < 0fp && tri.W(1) < 0fp && tri.W(2) < 0fp));
+
+        if(perspective){
+            // The varyings divided by w are linear in screen space. 1/w is normalized
+            // by the nearest vertex so it stays within the precision of a fixed.
+            vec3f w = vec3f(abs(tri.W(0)), abs(tri.W(1)), abs(tri.W(2)));
+            fixed nearest = min(w(0), min(w(1), w(2)));
+            vec3f weights = vec3f(
+                max(nearest / w(0), fixed(1, 0)),
+                max(nearest / w(1), fixed(1, 0)),
+                max(nearest / w(2), fixed(1, 0)));
+
+            setupVaryings(*tri.V1, *tri.V2, *tri.V3, weights, b2, b3, varyings);
+            q = Interpolant::FromWeights(weights(0), weights(1), weights(2), b2, b3);
+        } else {
+            setupVaryings(*tri.V1, *tri.V2, *tri.V3, vec3f(1fp), b2, b3, varyings);
+        }
+
+        return perspective;
+    }
+
+    // Converts a projected depth to the units of the depth buffer
+    FORCE_INLINE int64_t toDepth(fixed z){
+        return (int64_t)z.value * 65535 >> FIXED_32_FRAC_BITS;
+    }
+
+    // Coarse depth buffer holding an upper bound of the depth within every 8x8 block of
+    // the depth buffer. Triangles and blocks that lie entirely behind it can't pass the depth
+    // test and are skipped before any pixel is touched. Tiles are made of whole blocks,
+    // so a block is only ever accessed by the worker owning its tile.
+    constexpr int hiZBlockSize = 8;
+    constexpr int hiZCountX = (FRAME_WIDTH + hiZBlockSize - 1) / hiZBlockSize;
+    constexpr int hiZCountY = (FRAME_HEIGHT + hiZBlockSize - 1) / hiZBlockSize;
+
+    static_assert(RENDER_TILE_SIZE % hiZBlockSize == 0, "Tiles must be made of whole Hi-Z blocks");
+    static_assert(hiZBlockSize % PERSPECTIVE_SPAN_LENGTH == 0, "Perspective spans must not straddle Hi-Z blocks");
+    static_assert(hiZCountX <= 32, "A row of Hi-Z blocks must fit into a 32 bit mask");
+    static_assert(hiZBlockSize <= 32, "Spans must fit into the 32 bit mask of a span program");
+
+    // Triangles whose bounds within a tile are at most this many pixels wide and high
+    // are rasterized without any block or span setup
+    constexpr int smallTriangleSize = 4;
+    static_assert(smallTriangleSize <= hiZBlockSize, "Small triangles must not span more than two Hi-Z blocks per row");
+
+    // Blocks in a row of the Hi-Z buffer of a target. A block is marked dirty when a depth
+    // within it has been written. Writes only ever loosen the bound, it's tightened again
+    // by rescanning the block before the next draw call.
+    FORCE_INLINE int hiZStride(RenderTarget& target){
+        return (target.Size.x() + hiZBlockSize - 1) / hiZBlockSize;
+    }
+
+    FORCE_INLINE int hiZBlockCount(RenderTarget& target){
+        return hiZStride(target) * ((target.Size.y() + hiZBlockSize - 1) / hiZBlockSize);
+    }
+
+#ifdef RENDER_DEBUG_STATS
+    // Kept per tile so workers never share a counter, DrawMesh counts into the first tile
+    Debug::Stats tileStats[tileCount];
+#endif
+
+    // Clears are resolved per tile when the tile is first drawn to instead of up front. A tile
+    // still holds its contents from before the last Clear while its generation differs from
+    // the clear generation, so a Clear only has to advance the generation.
+    uint32_t clearGeneration = 0;
+    // Every frame buffer keeps its own color generations, they are swapped with the buffers
+    int currentFrameBuffer = 0;
+    uint32_t colorGeneration[RENDER_FRAME_BUFFER_COUNT][tileCount];
+    uint32_t depthGeneration[tileCount];
+    Color565 clearColor;
+
+    void resolveTile(int tile, bool depth){
+        int16_t x0 = SCAST<int16_t>((tile % tileCountX) * RENDER_TILE_SIZE);
+        int16_t y0 = SCAST<int16_t>((tile / tileCountX) * RENDER_TILE_SIZE);
+        int16_t x1 = min(SCAST<int16_t>(x0 + RENDER_TILE_SIZE), SCAST<int16_t>(FRAME_WIDTH));
+        int16_t y1 = min(SCAST<int16_t>(y0 + RENDER_TILE_SIZE), SCAST<int16_t>(FRAME_HEIGHT));
+
+        if(colorGeneration[currentFrameBuffer][tile] != clearGeneration){
+            for(int y = y0; y < y1; y++){
+                for(int x = x0; x < x1; x++){
+                    MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = clearColor;
+                }
+            }
+
+            colorGeneration[currentFrameBuffer][tile] = clearGeneration;
+        }
+
+        if(depth && depthGeneration[tile] != clearGeneration){
+            for(int y = y0; y < y1; y++){
+                for(int x = x0; x < x1; x++){
+                    MainTarget.DepthBuffer[y * FRAME_WIDTH + x] = 65535;
+                }
+            }
+
+            depthGeneration[tile] = clearGeneration;
+        }
+    }
+
+    // Resolves the tiles overlapping [x0, x1) x [y0, y1)
+    void resolveRegion(int x0, int y0, int x1, int y1, bool depth){
+        x0 = max(x0, 0);
+        y0 = max(y0, 0);
+        x1 = min(x1, FRAME_WIDTH);
+        y1 = min(y1, FRAME_HEIGHT);
+
+        if(x0 >= x1 || y0 >= y1) return;
+
+        for(int ty = y0 / RENDER_TILE_SIZE; ty <= (y1 - 1) / RENDER_TILE_SIZE; ty++){
+            for(int tx = x0 / RENDER_TILE_SIZE; tx <= (x1 - 1) / RENDER_TILE_SIZE; tx++){
+                resolveTile(ty * tileCountX + tx, depth);
+            }
+        }
+    }
+
+    // For tiles that have been completely overwritten
+    FORCE_INLINE void markResolved(int tile){
+        colorGeneration[currentFrameBuffer][tile] = clearGeneration;
+        depthGeneration[tile] = clearGeneration;
+    }
+
+    FORCE_INLINE void markDepthWritten(RenderTarget& target, int x, int y){
+        target.HiZDirty[(y / hiZBlockSize) * hiZStride(target) + x / hiZBlockSize] = true;
+    }
+
+    // Rescans the dirty blocks overlapping [x0, x1) x [y0, y1).
+    void refreshHiZ(RenderTarget& target, int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        if(target.DepthBuffer == nullptr) return;
+
+        int stride = hiZStride(target);
+
+        for(int by = y0 / hiZBlockSize; by * hiZBlockSize < y1; by++){
+            for(int bx = x0 / hiZBlockSize; bx * hiZBlockSize < x1; bx++){
+                int block = by * stride + bx;
+
+                if(!target.HiZDirty[block]) continue;
+
+                int maxX = min((bx + 1) * hiZBlockSize, SCAST<int>(target.Size.x()));
+                int maxY = min((by + 1) * hiZBlockSize, SCAST<int>(target.Size.y()));
+                uint16_t farthest = 0;
+
+                for(int y = by * hiZBlockSize; y < maxY; y++){
+                    for(int x = bx * hiZBlockSize; x < maxX; x++){
+                        farthest = max(farthest, target.DepthBuffer[y * target.Size.x() + x]);
+                    }
+                }
+
+                target.HiZ[block] = farthest;
+                target.HiZDirty[block] = false;
+            }
+        }
+    }
+
+    // Whether a fragment at the given depth or farther fails the depth test against
+    // every pixel of a block. Only the less tests can be decided by an upper bound.
+    FORCE_INLINE bool hiZOccludes(uint16_t bound, uint16_t nearest, DepthTest depthTestMode){
+        switch(depthTestMode){
+            case DepthTest::Less:
+                return nearest >= bound;
+            case DepthTest::Equal:
+            case DepthTest::LessEqual:
+                return nearest > bound;
+            default:
+                return false;
+        }
+    }
+
+    // Range of an edge function over a rectangle that extends w pixels to the right and
+    // h pixels down from the pixel the edge function has been evaluated at.
+    FORCE_INLINE int edgeMin(int edge, int a, int b, int w, int h){
+        return edge + min(a, 0) * w + min(b, 0) * h;
+    }
+
+    FORCE_INLINE int edgeMax(int edge, int a, int b, int w, int h){
+        return edge + max(a, 0) * w + max(b, 0) * h;
+    }
+
+    // Walks floor(w / Divisor) down the rows of a triangle for an edge function w that
+    // changes by a constant step per row. The scanline path uses it to find where an edge
+    // crosses every row without a division per row.
+    struct EdgeWalker {
+        int Quotient, Remainder;
+        int StepQuotient, StepRemainder;
+        int Divisor;
+
+        // Divisor must be positive
+        FORCE_INLINE static int FloorDiv(int n, int divisor){
+            int q = n / divisor;
+            return (n % divisor != 0 && n < 0) ? q - 1 : q;
+        }
+
+        FORCE_INLINE static EdgeWalker Start(int w, int step, int divisor){
+            int q = FloorDiv(w, divisor);
+            int sq = FloorDiv(step, divisor);
+            return { q, w - q * divisor, sq, step - sq * divisor, divisor };
+        }
+
+        FORCE_INLINE void StepY(){
+            Quotient += StepQuotient;
+            Remainder += StepRemainder;
+
+            if(Remainder >= Divisor){
+                Quotient++;
+                Remainder -= Divisor;
+            }
+        }
+    };
+
+    constexpr int64_t zFar = (int64_t)65535 << INTERPOLANT_FRAC_BITS;
+
+    bool testAndSetDepth(RenderTarget& target, vec2i16 pos, uint16_t val, DepthTest depthTestMode){
+        if(pos.x() < 0 || pos.x() >= target.Size.x() || pos.y() < 0 || pos.y() >= target.Size.y()) return false;
+        if(depthTestMode == DepthTest::Never) return true;
+
+        uint16_t& depth = target.DepthBuffer[pos.y() * target.Size.x() + pos.x()];
+
+        switch(depthTestMode){
+            case DepthTest::Less:
+                return val < depth && (depth = val);
+            case DepthTest::Greater:
+                return val > depth && (depth = val);
+            case DepthTest::Equal:
+                return val == depth && (depth = val);
+            case DepthTest::NotEqual:
+                return val != depth && (depth = val);
+            case DepthTest::LessEqual:
+                return val <= depth && (depth = val);
+            case DepthTest::GreaterEqual:
+                return val >= depth && (depth = val);
+            default:
+                return false;
+        }
+    }
+
+    // Same as testAndSetDepth, but resolved at compile time and without bounds checks.
+    template<DepthTest DepthTestMode>
+    FORCE_INLINE bool depthTest(uint16_t& depth, uint16_t value){
+        switch(DepthTestMode){
+            case DepthTest::Never:
+                return true;
+            case DepthTest::Less:
+                return value < depth && (depth = value, true);
+            case DepthTest::Equal:
+                return value == depth;
+            case DepthTest::LessEqual:
+                return value <= depth && (depth = value, true);
+            case DepthTest::Greater:
+                return value > depth && (depth = value, true);
+            case DepthTest::NotEqual:
+                return value != depth && (depth = value, true);
+            case DepthTest::GreaterEqual:
+                return value >= depth && (depth = value, true);
+            default:
+                return false;
+        }
+    }
+
+    template<typename S>
+    FORCE_INLINE Color565 fragmentColor(RenderTarget& target, const BinnedTriangle& tri, const mat4f& modelMat, const Material& material,
+                                        int16_t x, int16_t y, uint16_t depth, vec3f normal, vec2f uv){
+        FragmentShaderData data = {
+            *tri.V1, *tri.V2, *tri.V3,
+            modelMat,
+            normal,
+            uv,
+            vec3f(x, y, fixed((int64_t)depth, 4)),
+            target.Size,
+            tri.TriangleColor
+        };
+
+        runFragmentProgram<S>(material._Shader, data, material.Parameters);
+
+        return data.FragmentColor.ToColor565();
+    }
+
+    template<typename S>
+    FORCE_INLINE void shadeFragment(RenderTarget& target, const BinnedTriangle& tri, const mat4f& modelMat, const Material& material,
+                                    int16_t x, int16_t y, uint16_t depth, vec3f normal, vec2f uv){
+        target.ColorBuffer[y * target.Size.x() + x] = fragmentColor<S>(target, tri, modelMat, material, x, y, depth, normal, uv);
+    }
+
+    // Id of the triangle covering every pixel, written instead of shading the pixel in
+    // the geometry pass of the visibility buffer mode. Ids index the binned triangles,
+    // which also identify their draw call.
+    constexpr uint16_t noTriangle = 0xFFFF;
+    static_assert(RENDER_TRIANGLE_CAPACITY < noTriangle, "Triangle ids must fit into the visibility buffer");
+
+#ifdef RENDER_VISIBILITY_BUFFER
+    uint16_t visibilityBuffer[FRAME_WIDTH * FRAME_HEIGHT];
+#endif
+
+    // Shades the pixels [x0, x1) of row y. Without TestEdges the span is known to lie
+    // inside of the triangle and the edge functions aren't evaluated at all. With S set
+    // to DepthOnly only the depth is written, with WriteTriangleId the pixels are assigned
+    // to the triangle in the visibility buffer. Returns the number of pixels that passed
+    // the depth test, covered counts the pixels inside the triangle. The span lies within
+    // the frame, so the depth buffer is accessed without any checks. Shaders with a span
+    // program are invoked once for the whole span.
+    template<typename S, DepthTest DepthTestMode, bool TestEdges>
+    int rasterizeSpan(RenderTarget& target, const BinnedTriangle& tri, const mat4f& modelMat, const Material& material,
+                      int16_t y, int16_t x0, int16_t x1, int w1, int w2, int w3, int A12, int A20, int A01,
+                      Interpolant z, Interpolant (&varyings)[VaryingCount], int& covered){
+        constexpr bool shadesPixels = !std::is_same_v<S, DepthOnly> && !std::is_same_v<S, WriteTriangleId> &&
+                                      !HasSpanProgram<S>;
+        const Interpolant depth = z;
+        uint32_t mask = 0;
+        int passed = 0;
+
+        for(int16_t x = x0; x < x1; x++){
+            if(!TestEdges || (w1 | w2 | w3) >= 0){
+                covered++;
+
+                if(z.Value > 0 && z.Value < zFar){
+                    uint16_t z16 = SCAST<uint16_t>(z.Value >> INTERPOLANT_FRAC_BITS);
+
+                    if(depthTest<DepthTestMode>(target.DepthBuffer[y * target.Size.x() + x], z16)){
+                        if constexpr(std::is_same_v<S, WriteTriangleId>){
+#ifdef RENDER_VISIBILITY_BUFFER
+                            visibilityBuffer[y * FRAME_WIDTH + x] = SCAST<uint16_t>(&tri - triangles);
+#endif
+                        } else if constexpr(HasSpanProgram<S>){
+                            mask |= 1u << (x - x0);
+                        } else if constexpr(shadesPixels){
+                            shadeFragment<S>(target, tri, modelMat, material, x, y, z16,
+                                             vec3f(varyings[NormalX].Get(), varyings[NormalY].Get(), varyings[NormalZ].Get()),
+                                             vec2f(varyings[U].Get(), varyings[V].Get()));
+                        }
+
+                        passed++;
+                    }
+                }
+            }
+
+            if constexpr(TestEdges){
+                w1 += A12;
+                w2 += A20;
+                w3 += A01;
+            }
+
+            z.StepX();
+            if constexpr(shadesPixels){
+                for(int i = 0; i < VaryingCount; i++) varyings[i].StepX();
+            }
+        }
+
+        // Span programs get the pixels that passed in a single call, with the varyings
+        // still at the start of the span.
+        if constexpr(HasSpanProgram<S>){
+            if(mask != 0){
+                SpanShaderData data = {
+                    *tri.V1, *tri.V2, *tri.V3,
+                    modelMat,
+                    varyings[NormalX], varyings[NormalY], varyings[NormalZ],
+                    varyings[U], varyings[V],
+                    depth,
+                    x0, y,
+                    SCAST<int16_t>(x1 - x0),
+                    mask,
+                    target.Size,
+                    tri.TriangleColor,
+                    &target.ColorBuffer[y * target.Size.x() + x0]
+                };
+
+                ((S)material._Shader).SpanProgram(data, material.Parameters);
+            }
+        }
+
+        return passed;
+    }
+
+    // Spans never straddle a Hi-Z block, so their cells fit into a fixed array
+    constexpr int spanCellCapacity = hiZBlockSize / 2 + 1;
+
+    // Shades the pixels [x0, x1) of row y in cells two pixels wide, aligned to even columns.
+    // The depth test runs per pixel, the shader once per cell at its first pixel that passed.
+    // With pair set to 1, row y is the upper row of 2x2 cells and the cells inside of the
+    // triangle in both rows are shaded along with their pixels in row y + 1. With pair set
+    // to -1, row y is the lower row and those cells are skipped. Only a cell entirely inside
+    // of the triangle shares a color, so 2x2 cells crossed by an edge fall back to 2x1 cells
+    // per row and edges keep the full rate. Without TestEdges all pixels must be inside. The
+    // varyings only have to be valid along row y, which is also the only row span programs
+    // are invoked for. Returns the number of pixels that passed, shaded counts the cells.
+    template<typename S, DepthTest DepthTestMode, bool TestEdges>
+    int rasterizeCoarseSpan(RenderTarget& target, const BinnedTriangle& tri, const mat4f& modelMat, const Material& material,
+                            int16_t y, int16_t x0, int16_t x1, int pair, int w1, int w2, int w3, int A12, int A20, int A01,
+                            int B12, int B20, int B01, Interpolant z, const Interpolant (&varyings)[VaryingCount],
+                            int& covered, int& shaded){
+        struct Cell {
+            int Indices[4];
+            int Count;
+        };
+
+        Cell cells[spanCellCapacity];
+        int cellCount = 0;
+        uint32_t mask = 0;
+        int passed = 0;
+        int stride = target.Size.x();
+        int16_t cellMaxX;
+
+        for(int16_t cellX = x0; cellX < x1; cellX = cellMaxX){
+            cellMaxX = min(SCAST<int16_t>((cellX & ~1) + 2), x1);
+
+            // The pixels of row y in the low bits, the ones of the other row of the pair above them
+            int width = cellMaxX - cellX;
+            uint32_t rowBits = (1u << width) - 1;
+            uint32_t inside = pair != 0 ? rowBits | rowBits << 2 : rowBits;
+
+            if constexpr(TestEdges){
+                inside = 0;
+
+                for(int i = 0; i < width; i++){
+                    int offset = cellX - x0 + i;
+                    int e1 = w1 + A12 * offset;
+                    int e2 = w2 + A20 * offset;
+                    int e3 = w3 + A01 * offset;
+
+                    if((e1 | e2 | e3) >= 0) inside |= 1u << i;
+                    if(pair != 0 && ((e1 + B12 * pair) | (e2 + B20 * pair) | (e3 + B01 * pair)) >= 0) inside |= 4u << i;
+                }
+            }
+
+            bool twoRows = pair != 0 && inside == (rowBits | rowBits << 2);
+            if(twoRows && pair < 0) continue;
+
+            int rows = twoRows ? 2 : 1;
+            if(!twoRows) inside &= rowBits;
+            if(inside == 0) continue;
+
+            covered += __builtin_popcount(inside);
+
+            Cell& cell = cells[cellCount];
+            cell.Count = 0;
+
+            int16_t shadeX = cellX;
+            uint16_t shadeDepth = 0;
+
+            for(int row = 0; row < rows; row++){
+                int64_t depth = z.Value + z.DX * (cellX - x0) + z.DY * row;
+
+                for(int i = 0; i < width; i++, depth += z.DX){
+                    if(!(inside & (1u << (i + row * 2))) || depth <= 0 || depth >= zFar) continue;
+
+                    uint16_t z16 = SCAST<uint16_t>(depth >> INTERPOLANT_FRAC_BITS);
+                    int index = (y + row) * stride + cellX + i;
+
+                    if(!depthTest<DepthTestMode>(target.DepthBuffer[index], z16)) continue;
+
+                    if(cell.Count == 0){
+                        shadeX = cellX + i;
+                        shadeDepth = z16;
+                    }
+
+                    cell.Indices[cell.Count++] = index;
+                }
+            }
+
+            if(cell.Count == 0) continue;
+
+            passed += cell.Count;
+            shaded++;
+
+            // The first pixel that passed holds the color of the cell, cells with all of it
+            // in the lower row can't be left to the span program.
+            if(HasSpanProgram<S> && cell.Indices[0] < (y + 1) * stride){
+                mask |= 1u << (shadeX - x0);
+            } else {
+                Interpolant at[VaryingCount];
+
+                for(int i = 0; i < VaryingCount; i++){
+                    at[i] = varyings[i];
+                    at[i].Value += at[i].DX * (shadeX - x0);
+                }
+
+                target.ColorBuffer[cell.Indices[0]] = fragmentColor<S>(target, tri, modelMat, material, shadeX, y, shadeDepth,
+                                                                       vec3f(at[NormalX].Get(), at[NormalY].Get(), at[NormalZ].Get()),
+                                                                       vec2f(at[U].Get(), at[V].Get()));
+            }
+
+            cellCount++;
+        }
+
+        if constexpr(HasSpanProgram<S>){
+            if(mask != 0){
+                SpanShaderData data = {
+                    *tri.V1, *tri.V2, *tri.V3,
+                    modelMat,
+                    varyings[NormalX], varyings[NormalY], varyings[NormalZ],
+                    varyings[U], varyings[V],
+                    z,
+                    x0, y,
+                    SCAST<int16_t>(x1 - x0),
+                    mask,
+                    target.Size,
+                    tri.TriangleColor,
+                    &target.ColorBuffer[y * target.Size.x() + x0]
+                };
+
+                ((S)material._Shader).SpanProgram(data, material.Parameters);
+            }
+        }
+
+        for(int c = 0; c < cellCount; c++){
+            for(int i = 1; i < cells[c].Count; i++){
+                target.ColorBuffer[cells[c].Indices[i]] = target.ColorBuffer[cells[c].Indices[0]];
+            }
+        }
+
+        return passed;
+    }
+
+#ifdef RENDER_VISIBILITY_BUFFER
+    // Shading pass of the visibility buffer mode. Reconstructs the weights of a triangle
+    // from the same snapped edge functions the geometry pass tested and shades the pixels
+    // of [x0, x1) x [y0, y1) assigned to it. Varyings are divided by w at every pixel.
+    // Returns the number of shaded pixels.
+    template<typename S>
+    int resolveTriangle(RenderTarget& target, uint16_t id, const BinnedTriangle& tri, const mat4f& modelMat, const Material& material,
+                        Interpolation interpolationMode, int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        int16_t minX = max(tri.MinX, x0);
+        int16_t minY = max(tri.MinY, y0);
+        int16_t maxX = min(tri.MaxX, x1);
+        int16_t maxY = min(tri.MaxY, y1);
+
+        if(minX >= maxX || minY >= maxY) return 0;
+
+        vec2<int> v1 = snapToSubpixel(tri.P1);
+        vec2<int> v2 = snapToSubpixel(tri.P2);
+        vec2<int> v3 = snapToSubpixel(tri.P3);
+
+        int area = edgeFunctionFast(v1, v2, v3);
+        vec2<int> start = vec2<int>(minX * subpixel + subpixel / 2, minY * subpixel + subpixel / 2);
+
+        Interpolant b2 = Interpolant::Weight(edgeFunctionFast(v3, v1, start),
+                                             (v1.y() - v3.y()) * subpixel, (v3.x() - v1.x()) * subpixel, area);
+        Interpolant b3 = Interpolant::Weight(edgeFunctionFast(v1, v2, start),
+                                             (v2.y() - v1.y()) * subpixel, (v1.x() - v2.x()) * subpixel, area);
+
+        Interpolant z = Interpolant::FromWeights(toDepth(tri.P1(2)), toDepth(tri.P2(2)), toDepth(tri.P3(2)), b2, b3);
+
+        Interpolant planes[VaryingCount];
+        Interpolant q;
+        bool perspective = setupAttributes(tri, interpolationMode, b2, b3, planes, q);
+
+        int shaded = 0;
+
+        for(int16_t y = minY; y < maxY; y++){
+            for(int16_t x = minX; x < maxX; x++){
+                if(visibilityBuffer[y * FRAME_WIDTH + x] != id) continue;
+
+                int dx = x - minX;
+                int dy = y - minY;
+
+                Interpolant varyings[VaryingCount];
+                int64_t values[VaryingCount];
+
+                for(int i = 0; i < VaryingCount; i++){
+                    varyings[i].Value = planes[i].Value + planes[i].DX * dx + planes[i].DY * dy;
+                    values[i] = varyings[i].Value;
+                }
+
+                if(perspective){
+                    Interpolant pixelQ = q;
+                    pixelQ.Value += q.DX * dx + q.DY * dy;
+                    perspectiveDivide(varyings, pixelQ, values);
+                }
+
+                int64_t depth = z.Value + z.DX * dx + z.DY * dy;
+
+                shadeFragment<S>(target, tri, modelMat, material, x, y, SCAST<uint16_t>(depth >> INTERPOLANT_FRAC_BITS),
+                                 vec3f(fixed(values[NormalX], INTERPOLANT_FRAC_BITS),
+                                       fixed(values[NormalY], INTERPOLANT_FRAC_BITS),
+                                       fixed(values[NormalZ], INTERPOLANT_FRAC_BITS)),
+                                 vec2f(fixed(values[U], INTERPOLANT_FRAC_BITS), fixed(values[V], INTERPOLANT_FRAC_BITS)));
+                shaded++;
+            }
+        }
+
+        return shaded;
+    }
+#endif
+
+    using ProjectFunction = int (*)(RenderContext&, const Mesh&, uint32_t, const mat4f&, const mat4f&, const ModelEye&, const Material&,
+                                    VertexPool&, BinnedTriangle (&)[clipTriangleCapacity]);
+    using SpanFunction = int (*)(RenderTarget&, const BinnedTriangle&, const mat4f&, const Material&, int16_t, int16_t, int16_t,
+                                 int, int, int, int, int, int, Interpolant, Interpolant (&)[VaryingCount], int&);
+    using CoarseSpanFunction = int (*)(RenderTarget&, const BinnedTriangle&, const mat4f&, const Material&, int16_t, int16_t, int16_t,
+                                       int, int, int, int, int, int, int, int, int, int, Interpolant,
+                                       const Interpolant (&)[VaryingCount], int&, int&);
+#ifdef RENDER_VISIBILITY_BUFFER
+    using ResolveFunction = int (*)(RenderTarget&, uint16_t, const BinnedTriangle&, const mat4f&, const Material&, Interpolation,
+                                    int16_t, int16_t, int16_t, int16_t);
+#endif
+
+    // Instantiations indexed by the values of Culling and DepthTest
+    template<typename S>
+    constexpr ProjectFunction projectFunctions[] = {
+        projectTriangle<S, Culling::None>,
+        projectTriangle<S, Culling::Front>,
+        projectTriangle<S, Culling::Back>,
+    };
+
+    template<typename S, bool TestEdges>
+    constexpr SpanFunction spanFunctions[] = {
+        rasterizeSpan<S, DepthTest::Never, TestEdges>,
+        rasterizeSpan<S, DepthTest::Less, TestEdges>,
+        rasterizeSpan<S, DepthTest::Equal, TestEdges>,
+        rasterizeSpan<S, DepthTest::LessEqual, TestEdges>,
+        rasterizeSpan<S, DepthTest::Greater, TestEdges>,
+        rasterizeSpan<S, DepthTest::NotEqual, TestEdges>,
+        rasterizeSpan<S, DepthTest::GreaterEqual, TestEdges>,
+    };
+
+    template<typename S, bool TestEdges>
+    constexpr CoarseSpanFunction coarseSpanFunctions[] = {
+        rasterizeCoarseSpan<S, DepthTest::Never, TestEdges>,
+        rasterizeCoarseSpan<S, DepthTest::Less, TestEdges>,
+        rasterizeCoarseSpan<S, DepthTest::Equal, TestEdges>,
+        rasterizeCoarseSpan<S, DepthTest::LessEqual, TestEdges>,
+        rasterizeCoarseSpan<S, DepthTest::Greater, TestEdges>,
+        rasterizeCoarseSpan<S, DepthTest::NotEqual, TestEdges>,
+        rasterizeCoarseSpan<S, DepthTest::GreaterEqual, TestEdges>,
+    };
+
+    // The code paths specialized on the shader and modes of a draw call. Only the inner
+    // loops are instantiated per combination, the setup of triangles and blocks is shared
+    // to keep the code size in check.
+    struct Pipeline {
+        ProjectFunction Project;
+        // Spans of blocks partially covered by the triangle and spans known to be covered,
+        // indexed by the depth test. A pass may test depth differently than its draw call.
+        const SpanFunction* PartialSpans;
+        const SpanFunction* CoveredSpans;
+        // The same spans shaded at a reduced rate
+        const CoarseSpanFunction* PartialCoarseSpans;
+        const CoarseSpanFunction* CoveredCoarseSpans;
+#ifdef RENDER_VISIBILITY_BUFFER
+        ResolveFunction Resolve;
+#endif
+        // Size of the parameters of the shader, -1 if the shader doesn't declare them
+        int ParametersSize;
+    };
+
+    template<typename S>
+    constexpr int parametersSize(){
+        if constexpr(requires { typename S::Parameters; }) return sizeof(typename S::Parameters);
+        else return -1;
+    }
+
+    struct PipelineSelector {
+        Culling CullingMode;
+
+        template<typename S>
+        Pipeline Select() const {
+            return {
+                projectFunctions<S>[CullingMode],
+                spanFunctions<S, true>,
+                spanFunctions<S, false>,
+                coarseSpanFunctions<S, true>,
+                coarseSpanFunctions<S, false>,
+#ifdef RENDER_VISIBILITY_BUFFER
+                resolveTriangle<S>,
+#endif
+                parametersSize<S>()
+            };
+        }
+    };
+
+    Pipeline selectPipeline(const Material& material, Culling cullingMode){
+        return selectShader(material._Shader, PipelineSelector{ cullingMode });
+    }
+
+    enum RasterPass {
+        ShadePass,
+        DepthPass,
+        VisibilityPass,
+    };
+
+    // Selected on submission, parallel to drawCalls
+    Pipeline drawCallPipelines[DEFERRED_QUEUE_SIZE];
+
+    FORCE_INLINE SpanFunction selectSpan(const Pipeline& pipeline, RasterPass pass, DepthTest depthTestMode, bool testEdges){
+        switch(pass){
+            case DepthPass:
+                return testEdges ? spanFunctions<DepthOnly, true>[depthTestMode] : spanFunctions<DepthOnly, false>[depthTestMode];
+#ifdef RENDER_VISIBILITY_BUFFER
+            case VisibilityPass:
+                return testEdges ? spanFunctions<WriteTriangleId, true>[depthTestMode] : spanFunctions<WriteTriangleId, false>[depthTestMode];
+#endif
+            default:
+                return testEdges ? pipeline.PartialSpans[depthTestMode] : pipeline.CoveredSpans[depthTestMode];
+        }
+    }
+
+    // Rasterizes the part of a projected triangle that lies within [x0, x1) x [y0, y1).
+    // The depth pass only writes depth, the visibility pass assigns the pixels to the
+    // triangle in the visibility buffer instead of shading them, which requires the
+    // triangle to be binned. The shading rate only applies to the shading pass.
+    void rasterizeTriangle(RenderTarget& target, const BinnedTriangle& tri, const mat4f& modelMat, const Material& material,
+                           const Pipeline& pipeline, RasterPass pass, DepthTest depthTestMode, Interpolation interpolationMode,
+                           Rasterization rasterizationMode, ShadingRate shadingRate,
+                           int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        int16_t minX = max(tri.MinX, x0);
+        int16_t minY = max(tri.MinY, y0);
+        int16_t maxX = min(tri.MaxX, x1);
+        int16_t maxY = min(tri.MaxY, y1);
+
+        if(minX >= maxX || minY >= maxY) return;
+
+#ifdef RENDER_DEBUG_STATS
+        // Drawing into offscreen targets, like the occluders, isn't part of the frame
+        Debug::Stats offscreen;
+        Debug::Stats& stats = &target == &MainTarget ? tileStats[(y0 / RENDER_TILE_SIZE) * tileCountX + x0 / RENDER_TILE_SIZE] : offscreen;
+        stats.PixelsBounded += (maxX - minX) * (maxY - minY);
+#endif
+
+        vec3f pv1 = tri.P1;
+        vec3f pv2 = tri.P2;
+        vec3f pv3 = tri.P3;
+
+        // The edge functions are set up on the sub-pixel grid and sampled at pixel
+        // centers, their steps are per whole pixel.
+        vec2<int> v1 = snapToSubpixel(pv1);
+        vec2<int> v2 = snapToSubpixel(pv2);
+        vec2<int> v3 = snapToSubpixel(pv3);
+
+        int area = edgeFunctionFast(v1, v2, v3);
+
+        int A01 = (v2.y() - v1.y()) * subpixel, B01 = (v1.x() - v2.x()) * subpixel;
+        int A12 = (v3.y() - v2.y()) * subpixel, B12 = (v2.x() - v3.x()) * subpixel;
+        int A20 = (v1.y() - v3.y()) * subpixel, B20 = (v3.x() - v1.x()) * subpixel;
+
+        vec2<int> start = vec2<int>(minX * subpixel + subpixel / 2, minY * subpixel + subpixel / 2);
+
+        int w1_row = edgeFunctionFast(v2, v3, start);
+        int w2_row = edgeFunctionFast(v3, v1, start);
+        int w3_row = edgeFunctionFast(v1, v2, start);
+
+        int bias1 = topLeftBias(A12, B12);
+        int bias2 = topLeftBias(A20, B20);
+        int bias3 = topLeftBias(A01, B01);
+
+        // Triangles covering only a few pixels skip the block classification and the span
+        // setup. Their pixels are tested right away, which also rejects the many tiny
+        // triangles that don't cover any pixel center before their weights are set up.
+        // Rows of a triangle are contiguous, so every row is reduced to a covered span.
+        bool small = maxX - minX <= smallTriangleSize && maxY - minY <= smallTriangleSize;
+        int16_t smallStart[smallTriangleSize];
+        int16_t smallEnd[smallTriangleSize];
+
+        if(small){
+            bool anyCovered = false;
+
+            for(int row = 0; row < maxY - minY; row++){
+                smallStart[row] = maxX;
+                smallEnd[row] = minX;
+
+                for(int16_t x = minX; x < maxX; x++){
+                    int col = x - minX;
+
+                    if(((w1_row + bias1 + A12 * col + B12 * row) |
+                        (w2_row + bias2 + A20 * col + B20 * row) |
+                        (w3_row + bias3 + A01 * col + B01 * row)) >= 0){
+                        smallStart[row] = min(smallStart[row], x);
+                        smallEnd[row] = x + 1;
+                    }
+                }
+
+                anyCovered |= smallStart[row] < smallEnd[row];
+            }
+
+            if(!anyCovered) return;
+        }
+
+        // Depth and varyings are set up once per triangle as planes over screen space,
+        // so the loop below only has to step them. Depth is interpolated in the units
+        // of the depth buffer to skip the conversion per pixel.
+        Interpolant b2 = Interpolant::Weight(w2_row, A20, B20, area);
+        Interpolant b3 = Interpolant::Weight(w3_row, A01, B01, area);
+
+        // The weights above need the exact edge functions, only coverage is biased
+        w1_row += bias1;
+        w2_row += bias2;
+        w3_row += bias3;
+
+        int64_t z1 = toDepth(pv1.z());
+        int64_t z2 = toDepth(pv2.z());
+        int64_t z3 = toDepth(pv3.z());
+
+        Interpolant zRow = Interpolant::FromWeights(z1, z2, z3, b2, b3);
+
+        // Across so few pixels perspective correction makes no visible difference, small
+        // triangles are always interpolated affinely.
+        if(small){
+            SpanFunction span = selectSpan(pipeline, pass, depthTestMode, false);
+            Interpolant varyingRow[VaryingCount] = {};
+
+            if(pass == ShadePass) setupVaryings(*tri.V1, *tri.V2, *tri.V3, vec3f(1fp), b2, b3, varyingRow);
+
+            for(int row = 0; row < maxY - minY; row++){
+                int16_t y = minY + row;
+
+#ifdef RENDER_DEBUG_STATS
+                stats.PixelsTested += maxX - minX;
+#endif
+
+                if(smallStart[row] >= smallEnd[row]) continue;
+
+                int offset = smallStart[row] - minX;
+
+                Interpolant z = zRow;
+                z.Value += z.DX * offset + z.DY * row;
+
+                Interpolant varyings[VaryingCount];
+
+                for(int i = 0; i < VaryingCount; i++){
+                    varyings[i] = varyingRow[i];
+                    varyings[i].Value += varyings[i].DX * offset + varyings[i].DY * row;
+                }
+
+                int covered = 0;
+                int passed = span(target, tri, modelMat, material, y, smallStart[row], smallEnd[row],
+                                  0, 0, 0, A12, A20, A01, z, varyings, covered);
+
+#ifdef RENDER_DEBUG_STATS
+                stats.PixelsCovered += covered;
+                if(pass == ShadePass) stats.FragmentsShaded += passed;
+#endif
+
+                if(passed > 0){
+                    markDepthWritten(target, smallStart[row], y);
+                    markDepthWritten(target, smallEnd[row] - 1, y);
+                }
+            }
+
+            return;
+        }
+
+        // Classify the 8x8 blocks overlapped by the bounding box by their corners. Blocks
+        // outside of any edge or behind the Hi-Z buffer are skipped, blocks inside of all
+        // edges are drawn without testing the edges per pixel. The depth of the triangle
+        // within a block is bounded by its depth plane at the block corners and by its
+        // vertices, with a margin of one unit for the rounding of the plane.
+        int blockX0 = minX / hiZBlockSize;
+        int blockY0 = minY / hiZBlockSize;
+        int blockX1 = (maxX - 1) / hiZBlockSize;
+        int blockY1 = (maxY - 1) / hiZBlockSize;
+
+        int64_t zNearest = (min(z1, min(z2, z3)) - 1) << INTERPOLANT_FRAC_BITS;
+        int64_t zFarthest = (max(z1, max(z2, z3)) + 1) << INTERPOLANT_FRAC_BITS;
+        bool coverageUpdate = depthTestMode == DepthTest::Less || depthTestMode == DepthTest::LessEqual;
+        int hiZRow = hiZStride(target);
+
+        uint32_t visibleBlocks[hiZCountY];
+        uint32_t insideBlocks[hiZCountY];
+        bool anyVisible = false;
+
+        for(int by = blockY0; by <= blockY1; by++){
+            int16_t py0 = max(SCAST<int16_t>(by * hiZBlockSize), minY);
+            int16_t py1 = min(SCAST<int16_t>((by + 1) * hiZBlockSize), maxY) - 1;
+            int64_t dy0 = zRow.DY * (py0 - minY);
+            int64_t dy1 = zRow.DY * (py1 - minY);
+            uint32_t visible = 0;
+            uint32_t inside = 0;
+
+            for(int bx = blockX0; bx <= blockX1; bx++){
+                int16_t px0 = max(SCAST<int16_t>(bx * hiZBlockSize), minX);
+                int16_t px1 = min(SCAST<int16_t>((bx + 1) * hiZBlockSize), maxX) - 1;
+
+                int offsetX = px0 - minX;
+                int offsetY = py0 - minY;
+                int e1 = w1_row + A12 * offsetX + B12 * offsetY;
+                int e2 = w2_row + A20 * offsetX + B20 * offsetY;
+                int e3 = w3_row + A01 * offsetX + B01 * offsetY;
+
+                if(edgeMax(e1, A12, B12, px1 - px0, py1 - py0) < 0 ||
+                   edgeMax(e2, A20, B20, px1 - px0, py1 - py0) < 0 ||
+                   edgeMax(e3, A01, B01, px1 - px0, py1 - py0) < 0) continue;
+
+                int64_t dx0 = zRow.DX * (px0 - minX);
+                int64_t dx1 = zRow.DX * (px1 - minX);
+
+                int64_t nearest = max(zRow.Value + min(dx0, dx1) + min(dy0, dy1), zNearest);
+                int64_t farthest = min(zRow.Value + max(dx0, dx1) + max(dy0, dy1), zFarthest);
+
+                int block = by * hiZRow + bx;
+                uint16_t nearest16 = SCAST<uint16_t>(min(max(nearest >> INTERPOLANT_FRAC_BITS, (int64_t)0), (int64_t)65535));
+
+                if(hiZOccludes(target.HiZ[block], nearest16, depthTestMode)) continue;
+
+                visible |= 1u << (bx - blockX0);
+
+                if(edgeMin(e1, A12, B12, px1 - px0, py1 - py0) < 0 ||
+                   edgeMin(e2, A20, B20, px1 - px0, py1 - py0) < 0 ||
+                   edgeMin(e3, A01, B01, px1 - px0, py1 - py0) < 0) continue;
+
+                inside |= 1u << (bx - blockX0);
+
+                // Once the triangle has been drawn, a block it fully covers can't hold
+                // anything farther than the triangle itself.
+                if(coverageUpdate && nearest > 0 && farthest < zFar &&
+                   px1 - px0 == hiZBlockSize - 1 && py1 - py0 == hiZBlockSize - 1){
+                    target.HiZ[block] = min(target.HiZ[block], SCAST<uint16_t>(farthest >> INTERPOLANT_FRAC_BITS));
+                }
+            }
+
+            visibleBlocks[by - blockY0] = visible;
+            insideBlocks[by - blockY0] = inside;
+            anyVisible |= visible != 0;
+        }
+
+        if(!anyVisible) return;
+
+        // Passes that don't shade only write depth and triangle ids, the varyings aren't needed
+        Interpolant varyingRow[VaryingCount] = {};
+        Interpolant qRow = {};
+        bool perspective = pass == ShadePass && setupAttributes(tri, interpolationMode, b2, b3, varyingRow, qRow);
+
+        SpanFunction partialSpan = selectSpan(pipeline, pass, depthTestMode, true);
+        SpanFunction coveredSpan = selectSpan(pipeline, pass, depthTestMode, false);
+
+        // Rows are walked in spans aligned to multiples of their length, so a span never
+        // straddles a Hi-Z block and occluded blocks are skipped as a whole.
+        const int16_t spanLength = perspective ? PERSPECTIVE_SPAN_LENGTH : hiZBlockSize;
+
+        // The scanline path walks the left and right edges down the rows instead, so every
+        // row is reduced to a single span of covered pixels that is shaded without any
+        // edge tests. Edges of the same sign bound the span from the same side.
+        bool scanline = rasterizationMode == Rasterization::Scanline;
+        const int edgeA[3] = { A12, A20, A01 };
+
+        // Spans of the scanline path aren't tested against the edges, so their cells can't tell
+        // whether they lie on an edge.
+        bool coarse = pass == ShadePass && !scanline && shadingRate != ShadingRate::Rate1x1;
+        CoarseSpanFunction partialCoarseSpan = pipeline.PartialCoarseSpans[depthTestMode];
+        CoarseSpanFunction coveredCoarseSpan = pipeline.CoveredCoarseSpans[depthTestMode];
+        EdgeWalker walkers[3];
+
+        if(scanline){
+            const int edgeW[3] = { w1_row, w2_row, w3_row };
+            const int edgeB[3] = { B12, B20, B01 };
+
+            for(int i = 0; i < 3; i++){
+                if(edgeA[i] != 0) walkers[i] = EdgeWalker::Start(edgeW[i], edgeB[i], abs(edgeA[i]));
+            }
+        }
+
+        for(int16_t y = minY; y < maxY; y++){
+            uint32_t visible = visibleBlocks[y / hiZBlockSize - blockY0];
+            uint32_t inside = insideBlocks[y / hiZBlockSize - blockY0];
+            int blockRow = (y / hiZBlockSize) * hiZRow;
+
+            int16_t rowMinX = minX;
+            int16_t rowMaxX = maxX;
+
+            if(scanline){
+                const int edgeW[3] = { w1_row, w2_row, w3_row };
+                int left = 0;
+                int right = maxX - minX;
+
+                for(int i = 0; i < 3; i++){
+                    if(edgeA[i] > 0) left = max(left, -walkers[i].Quotient);
+                    else if(edgeA[i] < 0) right = min(right, walkers[i].Quotient + 1);
+                    else if(edgeW[i] < 0) right = 0;
+
+                    walkers[i].StepY();
+                }
+
+                rowMinX = SCAST<int16_t>(minX + left);
+                rowMaxX = SCAST<int16_t>(minX + max(right, left));
+            }
+
+            // 2x2 cells start on even rows, their odd rows are shaded along with them. Blocks are
+            // aligned to even rows, so both rows always lie within the same block and odd rows
+            // of blocks inside of the triangle are skipped as a whole.
+            int pair = 0;
+
+            if(coarse && shadingRate == ShadingRate::Rate2x2){
+                if(!(y & 1) && y + 1 < maxY) pair = 1;
+                else if((y & 1) && y > minY) pair = -1;
+            }
+
+            // Set while spanEnd holds the corrected varyings at the start of the next span
+            bool chained = false;
+            int64_t spanStart[VaryingCount];
+            int64_t spanEnd[VaryingCount];
+
+            int16_t spanMaxX;
+
+            for(int16_t spanX = rowMinX; spanX < rowMaxX; spanX = spanMaxX){
+                int16_t alignedX = spanX & ~(spanLength - 1);
+                spanMaxX = min(SCAST<int16_t>(alignedX + spanLength), rowMaxX);
+
+                int bx = spanX / hiZBlockSize;
+
+                if(!(visible & (1u << (bx - blockX0)))){
+                    chained = false;
+                    continue;
+                }
+
+                int offset = spanX - minX;
+
+                int w1 = w1_row + A12 * offset;
+                int w2 = w2_row + A20 * offset;
+                int w3 = w3_row + A01 * offset;
+
+                // Rows of partially covered blocks that miss the triangle are skipped too
+                bool testEdges = !scanline && !(inside & (1u << (bx - blockX0)));
+
+                if(testEdges && (edgeMax(w1, A12, 0, spanMaxX - spanX - 1, 0) < 0 ||
+                                 edgeMax(w2, A20, 0, spanMaxX - spanX - 1, 0) < 0 ||
+                                 edgeMax(w3, A01, 0, spanMaxX - spanX - 1, 0) < 0)){
+                    chained = false;
+                    continue;
+                }
+
+                if(coarse && !testEdges && pair < 0){
+                    chained = false;
+                    continue;
+                }
+
+                Interpolant z = zRow;
+                z.Value += z.DX * offset;
+
+                Interpolant varyings[VaryingCount];
+
+                if(perspective){
+                    // In perspective mode the varyings are only corrected at the ends of every
+                    // span and interpolated linearly in between.
+                    Interpolant projected[VaryingCount];
+                    Interpolant q = qRow;
+
+                    if(!chained){
+                        for(int i = 0; i < VaryingCount; i++){
+                            projected[i] = varyingRow[i];
+                            projected[i].Value += projected[i].DX * (alignedX - minX);
+                        }
+                        q.Value += q.DX * (alignedX - minX);
+
+                        perspectiveDivide(projected, q, spanEnd);
+                        q = qRow;
+                    }
+
+                    for(int i = 0; i < VaryingCount; i++){
+                        spanStart[i] = spanEnd[i];
+                        projected[i] = varyingRow[i];
+                        projected[i].Value += projected[i].DX * (alignedX + spanLength - minX);
+                    }
+                    q.Value += q.DX * (alignedX + spanLength - minX);
+
+                    perspectiveDivide(projected, q, spanEnd);
+
+                    for(int i = 0; i < VaryingCount; i++){
+                        varyings[i].DX = (spanEnd[i] - spanStart[i]) / PERSPECTIVE_SPAN_LENGTH;
+                        varyings[i].Value = spanStart[i] + varyings[i].DX * (spanX - alignedX);
+                    }
+
+                    chained = true;
+                } else {
+                    for(int i = 0; i < VaryingCount; i++){
+                        varyings[i] = varyingRow[i];
+                        varyings[i].Value += varyings[i].DX * offset;
+                    }
+                }
+
+                int covered = 0;
+                int shaded = 0;
+                int passed;
+
+                if(coarse){
+                    CoarseSpanFunction span = testEdges ? partialCoarseSpan : coveredCoarseSpan;
+                    passed = span(target, tri, modelMat, material, y, spanX, spanMaxX, pair,
+                                  w1, w2, w3, A12, A20, A01, B12, B20, B01, z, varyings, covered, shaded);
+                } else {
+                    SpanFunction span = testEdges ? partialSpan : coveredSpan;
+                    passed = span(target, tri, modelMat, material, y, spanX, spanMaxX,
+                                  w1, w2, w3, A12, A20, A01, z, varyings, covered);
+                    shaded = passed;
+                }
+
+#ifdef RENDER_DEBUG_STATS
+                if(testEdges) stats.PixelsTested += spanMaxX - spanX;
+                stats.PixelsCovered += covered;
+                if(pass == ShadePass) stats.FragmentsShaded += shaded;
+#endif
+
+                if(passed > 0) target.HiZDirty[blockRow + bx] = true;
+            }
+
+            w1_row += B12;
+            w2_row += B20;
+            w3_row += B01;
+
+            zRow.StepY();
+            qRow.StepY();
+            for(int i = 0; i < VaryingCount; i++) varyingRow[i].StepY();
+        }
+    }
+
+#ifdef RENDER_INCREMENTAL
+    // Material parameters are compared byte by byte, larger ones always count as changed
+    constexpr int recordParametersCapacity = 64;
+
+    // What a draw call looked like in a frame and the screen space bounds of its triangles
+    struct CallRecord {
+        const Mesh* _Mesh;
+        const Material* _Material;
+        mat4f ModelMatrix;
+        Culling CullingMode;
+        DepthTest DepthTestMode;
+        Interpolation InterpolationMode;
+        Rasterization RasterizationMode;
+        ShadingRate ShadingRateMode;
+        int ParametersSize;
+        uint8_t Parameters[recordParametersCapacity];
+        int16_t MinX, MinY, MaxX, MaxY;
+    };
+
+    // Calls of the current and the previous frame, the two sets are swapped in Prepare
+    CallRecord callRecords[2][DEFERRED_QUEUE_SIZE];
+    int callRecordCounts[2] = { 0, 0 };
+    int currentRecords = 0;
+
+    // Tiles that have to be rasterized again this frame. Tiles drawn to outside of the draw
+    // calls before rendering are remembered for the next frame as well.
+    bool damagedTiles[tileCount];
+    bool immediateTiles[tileCount];
+    // Cleared when the first tile is claimed, later drawing doesn't end up in the retained frame
+    bool recording = false;
+    bool invalidated = true;
+    // Set by Changed for frames that are the same as the previous one, which aren't rasterized
+    bool unchanged = false;
+
+    // Everything besides the draw calls that affects every pixel of the frame
+    mat4f recordedRVP;
+    vec3f recordedEye;
+    vec2i16 recordedResolution;
+    Color recordedClearColor;
+    Shading recordedShadingMode;
+
+    // The frame as it was left by the workers, before upscaling, post-processing and
+    // anything drawn on top. Tiles that aren't damaged are copied from here.
+    Color565 retainedFrame[FRAME_WIDTH * FRAME_HEIGHT];
+    uint16_t retainedDepth[FRAME_WIDTH * FRAME_HEIGHT];
+
+    void damageAll(){
+        for(int i = 0; i < tileCount; i++){
+            damagedTiles[i] = true;
+        }
+    }
+
+    // Damages the tiles overlapping [x0, x1) x [y0, y1)
+    void damage(int x0, int y0, int x1, int y1, bool immediate){
+        x0 = max(x0, 0);
+        y0 = max(y0, 0);
+        x1 = min(x1, FRAME_WIDTH);
+        y1 = min(y1, FRAME_HEIGHT);
+
+        if(x0 >= x1 || y0 >= y1) return;
+
+        for(int ty = y0 / RENDER_TILE_SIZE; ty <= (y1 - 1) / RENDER_TILE_SIZE; ty++){
+            for(int tx = x0 / RENDER_TILE_SIZE; tx <= (x1 - 1) / RENDER_TILE_SIZE; tx++){
+                damagedTiles[ty * tileCountX + tx] = true;
+                if(immediate) immediateTiles[ty * tileCountX + tx] = true;
+            }
+        }
+    }
+
+    bool sameCall(const CallRecord& a, const CallRecord& b){
+        return a._Mesh == b._Mesh && a._Material == b._Material &&
+               memcmp(&a.ModelMatrix, &b.ModelMatrix, sizeof(mat4f)) == 0 &&
+               a.CullingMode == b.CullingMode && a.DepthTestMode == b.DepthTestMode &&
+               a.InterpolationMode == b.InterpolationMode && a.RasterizationMode == b.RasterizationMode &&
+               a.ShadingRateMode == b.ShadingRateMode &&
+               a.ParametersSize >= 0 && a.ParametersSize == b.ParametersSize &&
+               memcmp(a.Parameters, b.Parameters, a.ParametersSize) == 0;
+    }
+
+    // Starts a new frame. Everything is damaged if anything but the draw calls changed.
+    void beginRecording(bool overflowed){
+        bool changed = invalidated || overflowed ||
+                       memcmp(&recordedRVP, &MainContext.RVP, sizeof(mat4f)) != 0 ||
+                       !(recordedEye == MainContext.EyePosition) || !(recordedResolution == MainContext.Resolution) ||
+                       memcmp(&recordedClearColor, &ClearColor, sizeof(Color)) != 0 ||
+                       recordedShadingMode != ShadingMode;
+
+        recordedRVP = MainContext.RVP;
+        recordedEye = MainContext.EyePosition;
+        recordedResolution = MainContext.Resolution;
+        recordedClearColor = ClearColor;
+        recordedShadingMode = ShadingMode;
+        invalidated = false;
+
+        for(int i = 0; i < tileCount; i++){
+            damagedTiles[i] = changed || immediateTiles[i];
+            immediateTiles[i] = false;
+        }
+
+        currentRecords = 1 - currentRecords;
+        callRecordCounts[currentRecords] = 0;
+        recording = true;
+        unchanged = false;
+    }
+
+    // Records a submitted call together with the bounds of its binned triangles and damages
+    // both its current and previous bounds if it differs from the call submitted at the same
+    // position in the previous frame.
+    void recordCall(const DrawCall& call, const Pipeline& pipeline, int16_t minX, int16_t minY, int16_t maxX, int16_t maxY){
+        int index = callRecordCounts[currentRecords]++;
+        CallRecord& record = callRecords[currentRecords][index];
+
+        record._Mesh = &call._Mesh;
+        record._Material = &call._Material;
+        record.ModelMatrix = call.ModelMatrix;
+        record.CullingMode = call.CullingMode;
+        record.DepthTestMode = call.DepthTestMode;
+        record.InterpolationMode = call.InterpolationMode;
+        record.RasterizationMode = call.RasterizationMode;
+        record.ShadingRateMode = call.ShadingRateMode;
+        record.ParametersSize = pipeline.ParametersSize <= recordParametersCapacity ? pipeline.ParametersSize : -1;
+        if(record.ParametersSize > 0) memcpy(record.Parameters, call._Material.Parameters, record.ParametersSize);
+        record.MinX = minX;
+        record.MinY = minY;
+        record.MaxX = maxX;
+        record.MaxY = maxY;
+
+        if(index < callRecordCounts[1 - currentRecords]){
+            const CallRecord& previous = callRecords[1 - currentRecords][index];
+            if(sameCall(record, previous)) return;
+
+            damage(previous.MinX, previous.MinY, previous.MaxX, previous.MaxY, false);
+        }
+
+        damage(minX, minY, maxX, maxY, false);
+    }
+
+    bool tileDamaged(int tile, int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        if(damagedTiles[tile]) return true;
+
+        // Calls of the previous frame that weren't submitted again
+        for(int i = callRecordCounts[currentRecords]; i < callRecordCounts[1 - currentRecords]; i++){
+            const CallRecord& previous = callRecords[1 - currentRecords][i];
+
+            if(previous.MinX < x1 && previous.MaxX > x0 && previous.MinY < y1 && previous.MaxY > y0) return true;
+        }
+
+        return false;
+    }
+
+    // Whether any tile has to be rasterized again, including the tiles of calls that weren't
+    // submitted again
+    bool frameDamaged(){
+        if(callRecordCounts[currentRecords] != callRecordCounts[1 - currentRecords]) return true;
+
+        for(int i = 0; i < tileCount; i++){
+            if(damagedTiles[i]) return true;
+        }
+
+        return false;
+    }
+
+    void restoreTile(int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        for(int y = y0; y < y1; y++){
+            memcpy(&MainTarget.ColorBuffer[y * FRAME_WIDTH + x0], &retainedFrame[y * FRAME_WIDTH + x0], (x1 - x0) * sizeof(Color565));
+            memcpy(&MainTarget.DepthBuffer[y * FRAME_WIDTH + x0], &retainedDepth[y * FRAME_WIDTH + x0], (x1 - x0) * sizeof(uint16_t));
+        }
+
+        for(int y = y0; y < y1; y += hiZBlockSize){
+            for(int x = x0; x < x1; x += hiZBlockSize){
+                markDepthWritten(MainTarget, x, y);
+            }
+        }
+    }
+
+    void retainTile(int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        for(int y = y0; y < y1; y++){
+            memcpy(&retainedFrame[y * FRAME_WIDTH + x0], &MainTarget.ColorBuffer[y * FRAME_WIDTH + x0], (x1 - x0) * sizeof(Color565));
+            memcpy(&retainedDepth[y * FRAME_WIDTH + x0], &MainTarget.DepthBuffer[y * FRAME_WIDTH + x0], (x1 - x0) * sizeof(uint16_t));
+        }
+    }
+#endif
+
+    // Prepares [x0, x1) x [y0, y1) for drawing outside of the draw calls by resolving pending
+    // clears. Only drawing between Prepare and Render has to be tracked for incremental
+    // rendering, later drawing doesn't end up in the retained frame.
+    FORCE_INLINE void touchImmediate(int x0, int y0, int x1, int y1){
+        resolveRegion(x0, y0, x1, y1, true);
+
+#ifdef RENDER_INCREMENTAL
+        if(recording) damage(x0, y0, x1, y1, true);
+#endif
+    }
+
+    // Draw calls that keep the nearest fragment can have their depth resolved up front.
+    // Others are left out of the depth pre-pass and test depth as usual afterwards.
+    FORCE_INLINE bool inDepthPrePass(const DrawCall& call){
+        return call.DepthTestMode == DepthTest::Less || call.DepthTestMode == DepthTest::LessEqual;
+    }
+
+    // Rasterizes the triangles binned into a tile in submission order. After a depth
+    // pre-pass the depth of the calls included in it is final, so only the fragments
+    // that ended up visible pass the equal test and get shaded.
+    void rasterizeBin(int tile, RasterPass pass, bool depthPrePass, int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        const DrawCall* previous = nullptr;
+
+        for(uint16_t entry = binHead[tile]; entry != binEnd; entry = binEntries[entry].Next){
+            const BinnedTriangle& tri = triangles[binEntries[entry].Triangle];
+            const DrawCall& call = *tri.Call;
+            DepthTest depthTestMode = call.DepthTestMode;
+            bool prePassed = depthPrePass && inDepthPrePass(call);
+
+            if(prePassed){
+                if(pass != DepthPass) depthTestMode = DepthTest::Equal;
+            } else if(pass == DepthPass){
+                continue;
+            }
+
+            if(tri.Call != previous){
+                refreshHiZ(MainTarget, x0, y0, x1, y1);
+                previous = tri.Call;
+            }
+
+#ifdef RENDER_DEBUG_STATS
+            Debug::Stats counted = tileStats[tile];
+#endif
+
+            rasterizeTriangle(MainTarget, tri, call.ModelMatrix, call._Material, drawCallPipelines[tri.Call - drawCalls], pass,
+                              depthTestMode, call.InterpolationMode, call.RasterizationMode, call.ShadingRateMode,
+                              x0, y0, x1, y1);
+
+#ifdef RENDER_DEBUG_STATS
+            // The pixels of the triangle were already counted by the depth pre-pass
+            if(prePassed && pass != DepthPass){
+                tileStats[tile].PixelsBounded = counted.PixelsBounded;
+                tileStats[tile].PixelsTested = counted.PixelsTested;
+                tileStats[tile].PixelsCovered = counted.PixelsCovered;
+            }
+#endif
+        }
+    }
+
+    void drawTile(int tile, int16_t x0, int16_t y0, int16_t x1, int16_t y1){
+        Shading shadingMode = ShadingMode;
+
+#ifndef RENDER_VISIBILITY_BUFFER
+        // Shades every pixel once as well, just without the buffer
+        if(shadingMode == Shading::VisibilityBuffer) shadingMode = Shading::DepthPrePass;
+#endif
+
+        if(shadingMode != Shading::VisibilityBuffer){
+            if(shadingMode == Shading::DepthPrePass) rasterizeBin(tile, DepthPass, true, x0, y0, x1, y1);
+
+            rasterizeBin(tile, ShadePass, shadingMode == Shading::DepthPrePass, x0, y0, x1, y1);
+            return;
+        }
+
+#ifdef RENDER_VISIBILITY_BUFFER
+        for(int y = y0; y < y1; y++){
+            for(int x = x0; x < x1; x++){
+                visibilityBuffer[y * FRAME_WIDTH + x] = noTriangle;
+            }
+        }
+
+        rasterizeBin(tile, VisibilityPass, false, x0, y0, x1, y1);
+
+        // Every pixel now holds the last triangle that passed its depth test, which is the
+        // one forward shading would have left in the frame buffer.
+        for(uint16_t entry = binHead[tile]; entry != binEnd; entry = binEntries[entry].Next){
+            uint16_t id = binEntries[entry].Triangle;
+            const BinnedTriangle& tri = triangles[id];
+            const DrawCall& call = *tri.Call;
+
+            int shaded = drawCallPipelines[tri.Call - drawCalls].Resolve(MainTarget, id, tri, call.ModelMatrix, call._Material,
+                                                                        call.InterpolationMode, x0, y0, x1, y1);
+
+#ifdef RENDER_DEBUG_STATS
+            tileStats[tile].FragmentsShaded += shaded;
+#else
+            (void)shaded;
+#endif
+        }
+#endif
+    }
 
-Color Renderer::ClearColor = Color::Black;
+    void rasterizeTile(int tile){
+        int16_t x0 = SCAST<int16_t>((tile % tileCountX) * RENDER_TILE_SIZE);
+        int16_t y0 = SCAST<int16_t>((tile / tileCountX) * RENDER_TILE_SIZE);
+        int16_t x1 = min(SCAST<int16_t>(x0 + RENDER_TILE_SIZE), MainContext.Resolution.x());
+        int16_t y1 = min(SCAST<int16_t>(y0 + RENDER_TILE_SIZE), MainContext.Resolution.y());
+
+        // Outside of the viewport of a reduced resolution, the pending clear is left to Upscale
+        if(x0 >= x1 || y0 >= y1) return;
+
+#ifdef RENDER_INCREMENTAL
+        // The frame buffer has been post-processed and drawn over since, so the tile is
+        // restored instead of left alone.
+        if(!tileDamaged(tile, x0, y0, x1, y1)){
+            restoreTile(x0, y0, x1, y1);
+            markResolved(tile);
+            return;
+        }
 
-Camera::Camera(fixed fov, fixed near, fixed far, fixed aspect){
-    this->fov = fov;
-    this->near = near;
-    this->far = far;
+        resolveTile(tile, true);
+        drawTile(tile, x0, y0, x1, y1);
+        retainTile(x0, y0, x1, y1);
+#else
+        // The depth of a tile nothing is drawn to stays pending until it's read
+        resolveTile(tile, binHead[tile] != binEnd);
+        drawTile(tile, x0, y0, x1, y1);
+#endif
+    }
 
-    projection = mat4f::perspective(fov, aspect, near, far);
+    void resetBins(){
+        drawCallCount = 0;
+        triangleCount = 0;
+        binEntryCount = 0;
+        clipVertexPool.Count = 0;
+        binOverflow = false;
+
+        for(int i = 0; i < tileCount; i++){
+            binHead[i] = binEnd;
+            binTail[i] = binEnd;
+        }
+    }
+
+    bool binTriangle(const BinnedTriangle& tri){
+        int tx0 = tri.MinX / RENDER_TILE_SIZE;
+        int ty0 = tri.MinY / RENDER_TILE_SIZE;
+        int tx1 = (tri.MaxX - 1) / RENDER_TILE_SIZE;
+        int ty1 = (tri.MaxY - 1) / RENDER_TILE_SIZE;
+
+        if(triangleCount >= RENDER_TRIANGLE_CAPACITY ||
+           binEntryCount + (tx1 - tx0 + 1) * (ty1 - ty0 + 1) > RENDER_BIN_CAPACITY){
+            return false;
+        }
+
+        uint16_t index = SCAST<uint16_t>(triangleCount++);
+        triangles[index] = tri;
+
+        for(int ty = ty0; ty <= ty1; ty++){
+            for(int tx = tx0; tx <= tx1; tx++){
+                int tile = ty * tileCountX + tx;
+                uint16_t entry = SCAST<uint16_t>(binEntryCount++);
+
+                binEntries[entry] = { index, binEnd };
+
+                if(binTail[tile] == binEnd) binHead[tile] = entry;
+                else binEntries[binTail[tile]].Next = entry;
+
+                binTail[tile] = entry;
+            }
+        }
+
+        return true;
+    }
+
+    // Rasterizes a mesh into any context on the calling core, bypassing the tile bins.
+    // Triangles are rasterized right away, so vertices created by clipping only have to
+    // outlive a single polygon.
+    void rasterizeMesh(RenderContext& context, const Mesh& mesh, const mat4f& modelMat, const Material& material, Culling cullingMode,
+                       RasterPass pass, DepthTest depthTestMode, Interpolation interpolationMode, Rasterization rasterizationMode,
+                       ShadingRate shadingRate){
+        RenderTarget& target = context.Target;
+
+        mat4f rMVP = context.RVP * modelMat;
+        ModelEye eye = toModelSpace(context, modelMat);
+        BinnedTriangle tris[clipTriangleCapacity];
+
+        Vertex vertices[clipVertexCapacity];
+        VertexPool pool = { vertices, 0, clipVertexCapacity };
+
+        Pipeline pipeline = selectPipeline(material, cullingMode);
+        if(pass == DepthPass) pipeline.Project = projectFunctions<DepthOnly>[cullingMode];
+
+        DepthTest depthTest = target.DepthBuffer != nullptr ? depthTestMode : DepthTest::Never;
+
+        refreshHiZ(target, 0, 0, context.Resolution.x(), context.Resolution.y());
+
+        for(uint32_t i = 0; i < mesh.PolygonCount; i++){
+            pool.Count = 0;
+            int count = pipeline.Project(context, mesh, i, modelMat, rMVP, eye, material, pool, tris);
+
+            for(int j = 0; j < count; j++){
+                tris[j].Call = nullptr;
+                rasterizeTriangle(target, tris[j], modelMat, material, pipeline, pass, depthTest, interpolationMode, rasterizationMode,
+                                  shadingRate, 0, 0, context.Resolution.x(), context.Resolution.y());
+            }
+        }
+    }
+
+    // Depth of the large draw calls submitted so far in the frame, at a fraction of the
+    // resolution. Draw calls whose volume lies entirely behind it are skipped before any of
+    // their polygons are projected.
+    RenderTarget occlusionTarget = RenderTarget(vec2i16(FRAME_WIDTH / RENDER_OCCLUSION_DOWNSAMPLE, FRAME_HEIGHT / RENDER_OCCLUSION_DOWNSAMPLE),
+                                                ColorFormat::NoColor);
+    RenderContext occlusionContext = RenderContext(occlusionTarget, MainCamera);
+
+    FORCE_INLINE bool writesNearest(DepthTest depthTestMode){
+        return depthTestMode == DepthTest::Less || depthTestMode == DepthTest::LessEqual;
+    }
+
+    // Only draw calls that cover a large part of the frame are worth rasterizing twice. The
+    // full mesh is rasterized, coarser levels of detail can stick out of it and hide calls
+    // that are visible.
+    void addOccluder(const DrawCall& call, int screenSize){
+        if(screenSize < RENDER_OCCLUDER_SIZE || !writesNearest(call.DepthTestMode)) return;
+
+        rasterizeMesh(occlusionContext, call._Mesh, call.ModelMatrix, call._Material, call.CullingMode, DepthPass, DepthTest::Less,
+                      Interpolation::Affine, Rasterization::HalfSpace, ShadingRate::Rate1x1);
+    }
+
+    // Pixels of the occlusion buffer are rasterized at their centers and may be partially
+    // covered, so the projected bounds are grown by a pixel on every side. For occluders
+    // with a convex outline this compares against the farthest depth around every pixel.
+    bool occluded(const BoundingVolume& volume, const mat4f& modelMat){
+        vec3f corners[8];
+        volume.GetCorners(&corners);
+
+        mat4f rMVP = occlusionContext.RVP * modelMat;
+        fixed minX = FRAME_WIDTH, minY = FRAME_HEIGHT, maxX = 0, maxY = 0, nearest = 1;
+
+        for(int i = 0; i < 8; i++){
+            vec4f clip = rMVP * vec4f(corners[i], 1);
+
+            // Corners in front of the near plane could be anywhere on screen
+            if(clip(2) > 0 || clip(3) >= 0) return false;
+
+            vec3f p = clip.homogenize();
+            minX = min(minX, p.x());
+            minY = min(minY, p.y());
+            maxX = max(maxX, p.x());
+            maxY = max(maxY, p.y());
+            nearest = min(nearest, p.z());
+        }
+
+        int x0 = max(SCAST<int>(floor(minX)) - 1, 0);
+        int y0 = max(SCAST<int>(floor(minY)) - 1, 0);
+        int x1 = min(SCAST<int>(ceil(maxX)) + 1, SCAST<int>(occlusionTarget.Size.x()));
+        int y1 = min(SCAST<int>(ceil(maxY)) + 1, SCAST<int>(occlusionTarget.Size.y()));
+
+        if(x0 >= x1 || y0 >= y1) return false;
+
+        uint16_t depth = SCAST<uint16_t>(min(max(toDepth(nearest), SCAST<int64_t>(0)), SCAST<int64_t>(65535)));
+
+        for(int y = y0; y < y1; y++){
+            for(int x = x0; x < x1; x++){
+                if(occlusionTarget.DepthBuffer[y * occlusionTarget.Size.x() + x] >= depth) return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool occluded(const DrawCall& call){
+        return writesNearest(call.DepthTestMode) && occluded(call._Mesh.Volume, call.ModelMatrix);
+    }
+};
+};
+
+RenderTarget::RenderTarget(vec2i16 size, ColorFormat format, bool depth){
+    Size = vec2i16(min(size.x(), SCAST<int16_t>(FRAME_WIDTH)), min(size.y(), SCAST<int16_t>(FRAME_HEIGHT)));
+    Format = format;
+    ColorBuffer = format != ColorFormat::NoColor ? new Color565[Size.x() * Size.y()] : nullptr;
+    DepthBuffer = depth ? new uint16_t[Size.x() * Size.y()] : nullptr;
+    TextureData = format == ColorFormat::RGBA4444 ? new Color16[Size.x() * Size.y()] : nullptr;
+
+    int blocks = Renderer::hiZBlockCount(*this);
+    HiZ = new uint16_t[blocks];
+    HiZDirty = new bool[blocks];
+
+    Clear(Color::Black);
 }
 
-mat4f Camera::GetViewMatrix(){
-    return rotation.ToMatrix() * mat4f::translate(-position);;
+RenderTarget::RenderTarget(vec2i16 size, Color565* colorBuffer, uint16_t* depthBuffer){
+    Size = size;
+    Format = ColorFormat::RGB565;
+    ColorBuffer = colorBuffer;
+    DepthBuffer = depthBuffer;
+    TextureData = nullptr;
+
+    int blocks = Renderer::hiZBlockCount(*this);
+    HiZ = new uint16_t[blocks];
+    HiZDirty = new bool[blocks];
+
+    for(int i = 0; i < blocks; i++){
+        HiZ[i] = 65535;
+        HiZDirty[i] = false;
+    }
 }
 
-// Frustum intersection test that checks if any of the bounding volume's corners
-// are inside the frustrum. Very naive and stupid but SAT is expensive.
-// This function can break for large bounding volumes or if the bounding volume
-// is too close to the camera.
-bool Camera::IntersectsFrustrum(const BoundingVolume& volume, const mat4f& translationMat){
-    vec3f corners[8];
-    volume.GetCorners(&corners);
+// The main target is cleared lazily per tile, offscreen targets are small enough to be
+// cleared right away.
+void RenderTarget::Clear(Color color){
+    if(this == &Renderer::MainTarget){
+        Renderer::Clear(color);
+        return;
+    }
 
-    mat4f MVP = GetProjectionMatrix() * GetViewMatrix() * translationMat;
+    Color565 c = color.ToColor565();
 
-    for(int i = 0; i < 8; i++){
-        vec3f corner = (MVP * vec4f(corners[i], 1)).homogenize();
-        if( corner.x() >= -1 && corner.x() <= 1 &&
-            corner.y() >= -1 && corner.y() <= 1 &&
-            corner.z() > 0 && corner.z() < 1){
-            return true;
+    for(int i = 0; i < Size.x() * Size.y(); i++){
+        if(ColorBuffer != nullptr) ColorBuffer[i] = c;
+        if(DepthBuffer != nullptr) DepthBuffer[i] = 65535;
+    }
+
+    int blocks = Renderer::hiZBlockCount(*this);
+
+    for(int i = 0; i < blocks; i++){
+        HiZ[i] = 65535;
+        HiZDirty[i] = false;
+    }
+}
+
+void RenderTarget::Resolve(){
+    if(this == &Renderer::MainTarget) Renderer::Resolve();
+
+    if(Format != ColorFormat::RGBA4444) return;
+
+    for(int i = 0; i < Size.x() * Size.y(); i++){
+        Color c = Color(ColorBuffer[i]);
+        if(DepthBuffer != nullptr && DepthBuffer[i] == 65535) c.a = 0;
+        TextureData[i] = c.ToColor16();
+    }
+}
+
+RenderContext::RenderContext(RenderTarget& target, Camera& camera) : Target(target), _Camera(camera){
+    VP = mat4f::identity();
+    EyePosition = vec3f(0);
+    ViewProjection = mat<float, 4, 4>::identity();
+    SetViewport(target.Size);
+}
+
+// Since this is run only once per frame, we do the calculations with floats instead of fixed
+// for better precision. Not doing so will lead to overflows during the multiplication.
+void RenderContext::Update(){
+    ViewProjection = (mat<float, 4, 4>)_Camera.GetProjectionMatrix() *
+                     (mat<float, 4, 4>)_Camera.GetViewMatrix();
+    VP = ViewProjection;
+    RVP = (mat<float, 4, 4>)RasterizationMat * ViewProjection;
+    EyePosition = _Camera.GetPosition();
+
+    // Visible points have a negative w, so they lie between w and -w in x and y and between w
+    // and 0 in z. Each of these bounds is a plane made of two rows of the view projection.
+    vec4<float> x = ViewProjection(0);
+    vec4<float> y = ViewProjection(1);
+    vec4<float> z = ViewProjection(2);
+    vec4<float> w = ViewProjection(3);
+    vec4<float> planes[6] = { x - w, -x - w, y - w, -y - w, -z, z - w };
+
+    for(int i = 0; i < 6; i++){
+        vec3<float> normal = planes[i].xyz();
+        FrustrumPlanes[i] = planes[i] / sqrtf(normal * normal);
+    }
+}
+
+// The volume is tested as the axis aligned box enclosing it in world space, which is accepted as
+// long as its corner farthest along the normal of every plane is inside of that plane.
+bool RenderContext::IntersectsFrustrum(const BoundingVolume& volume, const mat4f& modelMat){
+    vec3<float> center = vec3<float>((volume.Min + volume.Max) / 2);
+    vec3<float> extent = vec3<float>(volume.Max - volume.Min) / 2;
+    vec3<float> worldCenter;
+    vec3<float> worldExtent;
+
+    for(int r = 0; r < 3; r++){
+        worldCenter[r] = SCAST<float>(modelMat(r, 3));
+        worldExtent[r] = 0;
+
+        for(int c = 0; c < 3; c++){
+            float m = SCAST<float>(modelMat(r, c));
+            worldCenter[r] += m * center(c);
+            worldExtent[r] += fabsf(m) * extent(c);
         }
-    };
+    }
 
-    return false;
+    return intersectsBox(worldCenter, worldExtent);
 }
 
-#ifdef PLATFORM_PICO
+bool RenderContext::IntersectsFrustrum(const BoundingVolume& volume){
+    return intersectsBox(vec3<float>((volume.Min + volume.Max) / 2), vec3<float>(volume.Max - volume.Min) / 2);
+}
 
-#include <pico/multicore.h>
-#include <pico/util/queue.h>
+bool RenderContext::IntersectsFrustrum(vec3f center, fixed radius){
+    vec3<float> c = vec3<float>(center);
 
-queue_t queue;
+    for(int i = 0; i < 6; i++){
+        const vec4<float>& plane = FrustrumPlanes[i];
+        if(plane(0) * c(0) + plane(1) * c(1) + plane(2) * c(2) + plane(3) < -SCAST<float>(radius)) return false;
+    }
 
-void Renderer::Submit(const DrawCall& drawCall){
-    queue_add_blocking(&queue, &drawCall);
+    return true;
 }
 
-bool Renderer::Render(){
-    DrawCall* drawCall = (DrawCall*)malloc(sizeof(DrawCall));
-    bool valid = queue_try_remove(&queue, drawCall);
+bool RenderContext::intersectsBox(const vec3<float>& center, const vec3<float>& extent){
+    for(int i = 0; i < 6; i++){
+        const vec4<float>& plane = FrustrumPlanes[i];
+        float distance = plane(0) * center(0) + plane(1) * center(1) + plane(2) * center(2) + plane(3);
+        float reach = fabsf(plane(0)) * extent(0) + fabsf(plane(1)) * extent(1) + fabsf(plane(2)) * extent(2);
 
-    if(!valid){
-        free(drawCall);
-        return false;
+        if(distance + reach < 0) return false;
     }
 
-    DrawMesh(drawCall->_Mesh, drawCall->ModelMatrix, drawCall->_Material, drawCall->CullingMode, drawCall->DepthTestMode);
+    return true;
+}
+
+void RenderContext::SetViewport(vec2i16 size){
+    Resolution = size;
+    Bounds = BoundingBox2D(vec2f(0, 0), vec2f(size.x(), size.y()));
+    RasterizationMat =
+        mat4f::scale(vec3f(size.x(), size.y(), 1)) *
+        mat4f::translate(vec3f(0.5, 0.5, 0)) *
+        mat4f::scale(vec3f(0.5, 0.5, 1));
+    RVP = (mat<float, 4, 4>)RasterizationMat * ViewProjection;
+}
+
+#ifdef PLATFORM_PICO
+
+#include <pico/multicore.h>
+#include <hardware/sync.h>
 
-    free(drawCall);
+spin_lock_t* tileLock;
+int nextTile = 0;
 
-    return !queue_is_empty(&queue);
+FORCE_INLINE int claimTile(){
+    uint32_t save = spin_lock_blocking(tileLock);
+    int tile = nextTile++;
+    spin_unlock(tileLock, save);
+    return tile;
 }
 
+// Core 1 signals core 0 once it ran out of tiles, core 0 waits for that signal.
 void Renderer::Finish(){
-    multicore_fifo_pop_blocking();
+    if(get_core_num() == 1){
+        multicore_fifo_push_blocking(0);
+    } else {
+        multicore_fifo_pop_blocking();
+    }
 }
 
 #elif PLATFORM_NATIVE
 
-#include <queue>
-#include <mutex>
+#include <atomic>
 #include <barrier>
 
-std::mutex queueMutex;
-std::queue<DrawCall> drawQueue;
+std::atomic<int> nextTile = 0;
 
-void Renderer::Submit(const DrawCall& drawCall){
-    queueMutex.lock();
-    drawQueue.push(drawCall);
-    queueMutex.unlock();
+FORCE_INLINE int claimTile(){
+    return nextTile.fetch_add(1, std::memory_order_relaxed);
 }
 
-bool Renderer::Render(){
-    queueMutex.lock();
+extern std::barrier<> renderDoneBarrier;
 
-    if(drawQueue.empty()){
-        queueMutex.unlock();
-        return false;
+void Renderer::Finish(){
+    renderDoneBarrier.arrive_and_wait();
+}
+#endif
+
+// Bins the draw call on the calling core. All draw calls of a frame must be submitted
+// before any worker starts calling Render.
+void Renderer::Submit(const DrawCall& submitted){
+    if(!MainContext.IntersectsFrustrum(submitted._Mesh.Volume, submitted.ModelMatrix)){
+        return;
+    }
+
+    if(occluded(submitted)){
+        return;
+    }
+
+    int screenSize = projectedSize(MainContext, submitted._Mesh.Volume, submitted.ModelMatrix);
+    Mesh& lod = submitted._Mesh.SelectLod(screenSize);
+    DrawCall drawCall = DrawCall(lod, submitted.ModelMatrix, submitted._Material, submitted.CullingMode, submitted.DepthTestMode,
+                                 submitted.InterpolationMode, submitted.RasterizationMode, submitted.ShadingRateMode);
+
+    if(drawCallCount >= DEFERRED_QUEUE_SIZE){
+        if(!binOverflow) printf("Renderer: draw call limit reached, dropping draw calls\n");
+        binOverflow = true;
+#ifdef RENDER_INCREMENTAL
+        damageAll();
+#endif
+        return;
     }
-    
-    DrawCall drawCall = drawQueue.front();
-    drawQueue.pop();
 
-    bool empty = drawQueue.empty();
-    queueMutex.unlock();
+    Pipeline& pipeline = drawCallPipelines[drawCallCount];
+    pipeline = selectPipeline(drawCall._Material, drawCall.CullingMode);
 
-    DrawMesh(drawCall._Mesh, drawCall.ModelMatrix, drawCall._Material, drawCall.CullingMode, drawCall.DepthTestMode);
+    DrawCall* call = new (&drawCalls[drawCallCount++]) DrawCall(drawCall);
 
-    return !empty;
+    mat4f rMVP = MainContext.RVP * call->ModelMatrix;
+    ModelEye eye = toModelSpace(MainContext, call->ModelMatrix);
+    BinnedTriangle tris[clipTriangleCapacity];
+    int16_t minX = FRAME_WIDTH, minY = FRAME_HEIGHT, maxX = 0, maxY = 0;
+
+    for(uint32_t i = 0; i < call->_Mesh.PolygonCount; i++){
+        int count = pipeline.Project(MainContext, call->_Mesh, i, call->ModelMatrix, rMVP, eye, call->_Material, clipVertexPool, tris);
+
+        for(int j = 0; j < count; j++){
+            tris[j].Call = call;
+
+            if(!binTriangle(tris[j])){
+                if(!binOverflow) printf("Renderer: triangle bins are full, dropping triangles\n");
+                binOverflow = true;
+#ifdef RENDER_INCREMENTAL
+                damageAll();
+#endif
+                return;
+            }
+
+            minX = min(minX, tris[j].MinX);
+            minY = min(minY, tris[j].MinY);
+            maxX = max(maxX, tris[j].MaxX);
+            maxY = max(maxY, tris[j].MaxY);
+        }
+    }
+
+    // Calls that were dropped must not hide the ones submitted after them
+    addOccluder(submitted, screenSize);
+
+#ifdef RENDER_INCREMENTAL
+    recordCall(*call, pipeline, minX, minY, maxX, maxY);
+#endif
 }
 
-extern std::barrier<> renderDoneBarrier;
+bool Renderer::Changed(){
+#ifdef RENDER_INCREMENTAL
+    unchanged = !frameDamaged();
+    // Nothing is rasterized, so drawing from here on doesn't end up in the retained frame
+    if(unchanged) recording = false;
 
-void Renderer::Finish(){
-    renderDoneBarrier.arrive_and_wait();
+    return !unchanged;
+#else
+    return true;
+#endif
 }
+
+// Rasterizes the next unclaimed tile. Returns false once all tiles have been claimed.
+bool Renderer::Render(){
+#ifdef RENDER_INCREMENTAL
+    if(unchanged) return false;
+#endif
+
+    int tile = claimTile();
+
+    if(tile >= tileCount) return false;
+
+#ifdef RENDER_INCREMENTAL
+    if(tile == 0) recording = false;
 #endif
 
+    rasterizeTile(tile);
+
+    return tile + 1 < tileCount;
+}
+
 void Renderer::Init(){
-    rasterizationMat = 
-        mat4f::scale(vec3f(FRAME_WIDTH, FRAME_HEIGHT, 1)) *
-        mat4f::translate(vec3f(0.5, 0.5, 0)) *
-        mat4f::scale(vec3f(0.5, 0.5, 1));
+    MainContext.SetViewport(vec2i16(FRAME_WIDTH, FRAME_HEIGHT));
 
     #ifdef PLATFORM_PICO
-    queue_init(&queue, sizeof(DrawCall), DEFERRED_QUEUE_SIZE);
-    #elif PLATFORM_NATIVE
-    drawQueue = std::queue<DrawCall>();
+    tileLock = spin_lock_instance(spin_lock_claim_unused(true));
     #endif
+
+    resetBins();
 }
 
 void Renderer::Clear(Color color){
-    for(int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; i++){
-        FrameBuffer[i] = color.ToColor565();
-        Zbuffer[i] = 65535;
+    clearColor = color.ToColor565();
+    clearGeneration++;
+
+    for(int i = 0; i < hiZCountX * hiZCountY; i++){
+        MainTarget.HiZ[i] = 65535;
+        MainTarget.HiZDirty[i] = false;
     }
 }
 
 void Renderer::Prepare(){
+#ifdef RENDER_INCREMENTAL
+    bool overflowed = binOverflow;
+#endif
+
     Clear(ClearColor);
 
-    // Since this is run only once per frame, we do the calculations with floats instead of fixed
-    // for better precision. Not doing so will lead to overflows during the multiplication.
-    mat<float, 4, 4> vp = (mat<float, 4, 4>)MainCamera.GetProjectionMatrix() *
-                          (mat<float, 4, 4>)MainCamera.GetViewMatrix();
-    VP = vp;
-    RVP = (mat<float, 4, 4>)rasterizationMat * vp;
+    MainContext.Update();
+    MainContext.SetViewport(nextResolution);
+
+    occlusionTarget.Clear(ClearColor);
+    occlusionContext.Update();
+
+    resetBins();
+    nextTile = 0;
+
+#ifdef RENDER_INCREMENTAL
+    beginRecording(overflowed);
+#endif
+
+#ifdef RENDER_DEBUG_STATS
+    for(int i = 0; i < tileCount; i++){
+        tileStats[i] = {};
+    }
+#endif
+}
+
+void Renderer::Resolve(){
+    resolveRegion(0, 0, FRAME_WIDTH, FRAME_HEIGHT, true);
+}
+
+Color565* Renderer::SwapBuffers(){
+    Color565* finished = MainTarget.ColorBuffer;
+
+    currentFrameBuffer = (currentFrameBuffer + 1) % RENDER_FRAME_BUFFER_COUNT;
+    MainTarget.ColorBuffer = frameBuffers[currentFrameBuffer];
+
+    return finished;
+}
+
+void Renderer::Invalidate(){
+#ifdef RENDER_INCREMENTAL
+    invalidated = true;
+    damageAll();
+#endif
+}
+
+void Renderer::SetResolution(vec2i16 size){
+    nextResolution = vec2i16(min(max(size.x(), SCAST<int16_t>(1)), SCAST<int16_t>(FRAME_WIDTH)),
+                             min(max(size.y(), SCAST<int16_t>(1)), SCAST<int16_t>(FRAME_HEIGHT)));
+}
+
+vec2i16 Renderer::GetResolution(){
+    return MainContext.Resolution;
+}
+
+void Renderer::Upscale(){
+    vec2i16 size = MainContext.Resolution;
+    MainContext.SetViewport(vec2i16(FRAME_WIDTH, FRAME_HEIGHT));
+
+    // The frame is presented from here on, pending depth is resolved once it's read
+    if(size.x() == FRAME_WIDTH && size.y() == FRAME_HEIGHT){
+        resolveRegion(0, 0, FRAME_WIDTH, FRAME_HEIGHT, false);
+        return;
+    }
+
+    resolveRegion(0, 0, size.x(), size.y(), true);
+
+    int16_t sourceX[FRAME_WIDTH];
+    for(int x = 0; x < FRAME_WIDTH; x++){
+        sourceX[x] = SCAST<int16_t>(x * size.x() / FRAME_WIDTH);
+    }
+
+    // Walking backwards, a source pixel never lies after its destination and is
+    // therefore read before it gets overwritten.
+    for(int y = FRAME_HEIGHT - 1; y >= 0; y--){
+        int sourceRow = (y * size.y() / FRAME_HEIGHT) * FRAME_WIDTH;
+
+        for(int x = FRAME_WIDTH - 1; x >= 0; x--){
+            MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = MainTarget.ColorBuffer[sourceRow + sourceX[x]];
+            MainTarget.DepthBuffer[y * FRAME_WIDTH + x] = MainTarget.DepthBuffer[sourceRow + sourceX[x]];
+        }
+    }
+
+    for(int i = 0; i < hiZCountX * hiZCountY; i++){
+        MainTarget.HiZDirty[i] = true;
+    }
+
+    for(int i = 0; i < tileCount; i++){
+        markResolved(i);
+    }
 }
 
 void Renderer::DrawBox(BoundingBox2D box, Color color){
-    BoundingBox2D bbi = bounds.Intersect(box);
+    BoundingBox2D bbi = MainContext.Bounds.Intersect(box);
+
+    touchImmediate(SCAST<int>(bbi.Min.x()), SCAST<int>(bbi.Min.y()), SCAST<int>(bbi.Max.x()), SCAST<int>(bbi.Max.y()));
 
     for(int y = SCAST<int>(bbi.Min.y()); y < SCAST<int>(bbi.Max.y()); y++){
         for(int x = SCAST<int>(bbi.Min.x()); x < SCAST<int>(bbi.Max.x()); x++){
-            FrameBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+            MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
         }
     }
 }
@@ -164,6 +2452,8 @@ void Renderer::DrawBorder(BoundingBox2D box, uint8_t width, Color color){
     int32_t endX = SCAST<int32_t>(ceil(bbi.Max.x()));
     int32_t endY = SCAST<int32_t>(ceil(bbi.Max.y()));
 
+    touchImmediate(startX, startY, endX, endY);
+
     for(int y = startY; y < startY + width; y++){
         for(int x = startX; x < endX; x++){
             // FrameBuffer[y * FRAME_WIDTH + x] = color;
@@ -206,6 +2496,8 @@ void Renderer::DrawLine(vec2i16 start, vec2i16 end, Color color, uint8_t lineWid
 
     int32_t err = dx - dy;
 
+    touchImmediate(min(x0, x1) - lineWidth, min(y0, y1) - lineWidth, max(x0, x1) + lineWidth, max(y0, y1) + lineWidth);
+
     while(true){
         for(int y = y0 - lineWidth; y < y0 + lineWidth; y++){
             for(int x = x0 - lineWidth; x < x0 + lineWidth; x++){
@@ -231,8 +2523,8 @@ void Renderer::DrawLine(vec2i16 start, vec2i16 end, Color color, uint8_t lineWid
 
 // 3D Bresenham that respects the camera's frustrum and depth buffer
 void Renderer::DrawLine(vec3f p1, vec3f p2, Color color, uint8_t lineWidth, DepthTest depthTestMode){
-    vec3f pv1 = (RVP * vec4f(p1, 1)).homogenize();
-    vec3f pv2 = (RVP * vec4f(p2, 1)).homogenize();
+    vec3f pv1 = (MainContext.RVP * vec4f(p1, 1)).homogenize();
+    vec3f pv2 = (MainContext.RVP * vec4f(p2, 1)).homogenize();
 
     int32_t x0 = SCAST<int32_t>(pv1.x());
     int32_t y0 = SCAST<int32_t>(pv1.y());
@@ -244,6 +2536,8 @@ void Renderer::DrawLine(vec3f p1, vec3f p2, Color color, uint8_t lineWidth, Dept
     int32_t z0 = SCAST<int32_t>((float)pv1.z() * 65535.0f);
     int32_t z1 = SCAST<int32_t>((float)pv2.z() * 65535.0f);
 
+    touchImmediate(min(x0, x1) - lineWidth, min(y0, y1) - lineWidth, max(x0, x1) + lineWidth, max(y0, y1) + lineWidth);
+
     int32_t dx = abs(x1 - x0);
     int32_t dy = abs(y1 - y0);
     int32_t dz = abs(z1 - z0);
@@ -275,8 +2569,9 @@ void Renderer::DrawLine(vec3f p1, vec3f p2, Color color, uint8_t lineWidth, Dept
                 for(int x = x0 - lineWidth; x < x0 + lineWidth; x++){
                     if(x < 0 || x >= FRAME_WIDTH || y < 0 || y >= FRAME_HEIGHT) continue;
 
-                    if(testAndSetDepth(vec2i16(x, y), z0, depthTestMode)){
-                        FrameBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                    if(testAndSetDepth(MainTarget, vec2i16(x, y), z0, depthTestMode)){
+                        MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                        markDepthWritten(MainTarget, x, y);
                     }
                 }
             }
@@ -303,8 +2598,9 @@ void Renderer::DrawLine(vec3f p1, vec3f p2, Color color, uint8_t lineWidth, Dept
                 for(int x = x0 - lineWidth; x < x0 + lineWidth; x++){
                     if(x < 0 || x >= FRAME_WIDTH || y < 0 || y >= FRAME_HEIGHT) continue;
 
-                    if(testAndSetDepth(vec2i16(x, y), z0, depthTestMode)){
-                        FrameBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                    if(testAndSetDepth(MainTarget, vec2i16(x, y), z0, depthTestMode)){
+                        MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                        markDepthWritten(MainTarget, x, y);
                     }
                 }
             }
@@ -331,8 +2627,9 @@ void Renderer::DrawLine(vec3f p1, vec3f p2, Color color, uint8_t lineWidth, Dept
                 for(int x = x0 - lineWidth; x < x0 + lineWidth; x++){
                     if(x < 0 || x >= FRAME_WIDTH || y < 0 || y >= FRAME_HEIGHT) continue;
 
-                    if(testAndSetDepth(vec2i16(x, y), z0, depthTestMode)){
-                        FrameBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                    if(testAndSetDepth(MainTarget, vec2i16(x, y), z0, depthTestMode)){
+                        MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                        markDepthWritten(MainTarget, x, y);
                     }
                 }
             }
@@ -354,12 +2651,14 @@ void Renderer::DrawText(const char* text, vec2i16 pos, Color color){
 
         const uint8_t* glyph = TextFont.GetGlyph(c);
 
+        touchImmediate(x, y, x + TextFont.GlyphSize.x(), y + TextFont.GlyphSize.y());
+
         for(int gy = 0; gy < TextFont.GlyphSize.y(); gy++){
             int mask = 0b10000000;
 
             for(int gx = 0; gx < TextFont.GlyphSize.x(); gx++){
                 if(*glyph & mask){
-                    FrameBuffer[(y + gy) * FRAME_WIDTH + (x + gx)] = color.ToColor565();
+                    MainTarget.ColorBuffer[(y + gy) * FRAME_WIDTH + (x + gx)] = color.ToColor565();
                 }
                 mask >>= 1;
             }
@@ -373,165 +2672,90 @@ void Renderer::DrawText(const char* text, vec2i16 pos, Color color){
 
 void Renderer::Blit(const Texture2D& tex, vec2i16 pos){
     BoundingBox2D bbi = BoundingBox2D(pos, pos + vec2i16(tex.Width, tex.Height))
-                        .Intersect(bounds);
+                        .Intersect(MainContext.Bounds);
+
+    touchImmediate(SCAST<int>(floor(bbi.Min.x())), SCAST<int>(floor(bbi.Min.y())), SCAST<int>(ceil(bbi.Max.x())), SCAST<int>(ceil(bbi.Max.y())));
 
     for(int y = SCAST<int16_t>(floor(bbi.Min.y())); y < SCAST<int16_t>(ceil(bbi.Max.y())); y++){
         for(int x = SCAST<int16_t>(floor(bbi.Min.x())); x < SCAST<int16_t>(ceil(bbi.Max.x())); x++){
-            FrameBuffer[y * FRAME_WIDTH + x] = tex.GetPixel(vec2i16(x - pos.x(), y - pos.y())).ToColor565();
+            MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = tex.GetPixel(vec2i16(x - pos.x(), y - pos.y())).ToColor565();
         }
     }
 }
 
-void Renderer::DrawMesh(const Mesh& mesh, const mat4f& modelMat, const Material& material, const Culling cullingMode, const DepthTest depthTestMode){
-    if(!MainCamera.IntersectsFrustrum(mesh.Volume, modelMat)){
-        return;
-    }
-
-    mat4f rMVP = RVP * modelMat;
-    
-    for(int i = 0; i < mesh.PolygonCount; i++){
-        uint32_t idx = i * 3;
-
-        TriangleShaderData t = {
-            mesh.Vertices[mesh.Indices[idx]],
-            mesh.Vertices[mesh.Indices[idx+1]],
-            mesh.Vertices[mesh.Indices[idx+2]],
-            modelMat,
-            Color::Purple
-        };
-
-        // Time::Profiler::Enter("TriangleProgram");
-        executeTriangleProgram(material._Shader, t, material.Parameters);
-        // Time::Profiler::Exit("TriangleProgram");
-
-        vec3f pv1 = (rMVP * vec4f(t.V1.Position, 1)).homogenize();
-        vec3f pv2 = (rMVP * vec4f(t.V2.Position, 1)).homogenize();
-        vec3f pv3 = (rMVP * vec4f(t.V3.Position, 1)).homogenize();
-
-        BoundingBox2D bb = BoundingBox2D::FromTriangle(pv1.xy(), pv2.xy(), pv3.xy());
-        BoundingBox2D bbi = bounds.Intersect(bb);
-
-        if(bbi.IsEmpty()) continue;
-
-#ifdef RENDER_DEBUG_TRIANGLE_BOUNDING
-        DrawBorder(bbi, 1, Color::Yellow);
-#endif
-
-        fixed area;
-        vec3f windingOrder = (pv2 - pv1).cross(pv3 - pv1);
-
-        int A01, A12, A20, B01, B12, B20;
-        int w1_row, w2_row, w3_row;
-        vec2<int> min;
-
-        vec3<int> v1 = pv1;
-        vec3<int> v2 = pv2;
-        vec3<int> v3 = pv3;
-
-        switch(cullingMode){
-            case Culling::None:
-                break;
-            case Culling::Front:
-                if(windingOrder.z() < 0) goto render_debug;
-                break;
-            case Culling::Back:
-                if(windingOrder.z() > 0) goto render_debug;
-                break;
-        }
-
-        area = edgeFunctionFast(v1.xy(), v2.xy(), v3.xy());
-
-        if(area == 0) continue;
+void Renderer::DrawBillboard(const Texture2D& tex, vec3f pos, fixed extent, DepthTest depthTestMode){
+    vec3f center = (MainContext.RVP * vec4f(pos, 1)).homogenize();
 
-        A01 = v2.y() - v1.y(); B01 = v1.x() - v2.x();
-        A12 = v3.y() - v2.y(); B12 = v2.x() - v3.x();
-        A20 = v1.y() - v3.y(); B20 = v3.x() - v1.x();
+    if(center.z() <= 0 || center.z() >= 1) return;
 
-        min = vec2<int>(SCAST<int>(floor(bbi.Min.x())), SCAST<int>(floor(bbi.Min.y())));
+    // The camera's up vector in world space projects to the vertical half size on screen
+    vec3f up = MainCamera.GetRotation().ToMatrix()(1).xyz();
+    vec3f top = (MainContext.RVP * vec4f(pos + up * extent, 1)).homogenize();
+    fixed size = (top.xy() - center.xy()).magnitude();
 
-        w1_row = edgeFunctionFast(v2.xy(), v3.xy(), min);
-        w2_row = edgeFunctionFast(v3.xy(), v1.xy(), min);
-        w3_row = edgeFunctionFast(v1.xy(), v2.xy(), min);
+    if(size <= 0) return;
 
-        // Time::Profiler::Enter("Rasterization");
-        for(int16_t y = SCAST<int16_t>(floor(bbi.Min.y())); y < SCAST<int16_t>(ceil(bbi.Max.y())); y++){
-            int w1 = w1_row;
-            int w2 = w2_row;
-            int w3 = w3_row;
+    BoundingBox2D bbi = BoundingBox2D(center.xy() - vec2f(size, size), center.xy() + vec2f(size, size))
+                        .Intersect(MainContext.Bounds);
 
-            for(int16_t x = SCAST<int16_t>(floor(bbi.Min.x())); x < SCAST<int16_t>(ceil(bbi.Max.x())); x++){
-                if((w1 | w2 | w3) >= 0){
-                    vec3f uvw = vec3f(w1, w2, w3) / area;
-                    fixed z = vec3f(pv1.z(), pv2.z(), pv3.z()) * uvw;
+    if(bbi.IsEmpty()) return;
 
-                    Color fragmentColor = t.TriangleColor;
-                    uint16_t z16;
+    int x0 = SCAST<int>(floor(bbi.Min.x()));
+    int y0 = SCAST<int>(floor(bbi.Min.y()));
+    int x1 = SCAST<int>(ceil(bbi.Max.x()));
+    int y1 = SCAST<int>(ceil(bbi.Max.y()));
 
-                    if(z >= 1.0f || z <= 0.0f) goto update_baricentric;
+    touchImmediate(x0, y0, x1, y1);
 
-                    // The precision of a fixed point is not good enough to multiply by 65535
-                    // so we convert to float for the calculation
-                    z16 = SCAST<uint16_t>((float)z * 65535.0f);
+    uint16_t depth = SCAST<uint16_t>(toDepth(center.z()));
+    fixed left = center.x() - size;
+    fixed bottom = center.y() - size;
+    fixed step = fixed(SCAST<int>(tex.Width)) / (size * 2);
 
-                    if(!testAndSetDepth(vec2i16(x, y), z16, depthTestMode)) goto update_baricentric;
+    for(int y = y0; y < y1; y++){
+        int ty = min(max(SCAST<int>((fixed(y) + 0.5fp - bottom) * step), 0), SCAST<int>(tex.Height) - 1);
 
-                    FragmentShaderData data = {
-                        t.V1, t.V2, t.V3,
-                        modelMat,
-                        uvw,
-                        vec3f(x, y, z),
-                        vec2f(FRAME_WIDTH, FRAME_HEIGHT),
-                        fragmentColor
-                    };
+        for(int x = x0; x < x1; x++){
+            int tx = min(max(SCAST<int>((fixed(x) + 0.5fp - left) * step), 0), SCAST<int>(tex.Width) - 1);
+            Color color = tex.GetPixel(vec2i16(tx, ty));
 
-                    executeFragmentProgram(material._Shader, data, material.Parameters);
-
-                    FrameBuffer[y * FRAME_WIDTH + x] = data.FragmentColor.ToColor565();
-                }
+            if(color.a == 0) continue;
 
-                update_baricentric:
-                w1 += A12;
-                w2 += A20;
-                w3 += A01;
+            if(testAndSetDepth(MainTarget, vec2i16(x, y), depth, depthTestMode)){
+                MainTarget.ColorBuffer[y * FRAME_WIDTH + x] = color.ToColor565();
+                markDepthWritten(MainTarget, x, y);
             }
-
-            w1_row += B12;
-            w2_row += B20;
-            w3_row += B01;
         }
+    }
+}
 
-        // Time::Profiler::Exit("Rasterization");
-
-        // TODO: this doesn't properly render because the drawing of other triangles
-        //       will overwrite the debug drawings
-        render_debug:
-        #ifdef RENDER_DEBUG_WIREFRAME
-            Color color = Color::Cyan;
-            vec2i16 p1 = vec2i16(SCAST<int>(pv1.x()), SCAST<int>(pv1.y()));
-            vec2i16 p2 = vec2i16(SCAST<int>(pv2.x()), SCAST<int>(pv2.y()));
-            vec2i16 p3 = vec2i16(SCAST<int>(pv3.x()), SCAST<int>(pv3.y()));
-
-            DrawLine(p1, p2, color);
-            DrawLine(p2, p3, color);
-            DrawLine(p3, p1, color);
-        #endif
+// Immediately rasterizes a mesh on the calling core, bypassing the tile bins.
+void Renderer::DrawMesh(const Mesh& mesh, const mat4f& modelMat, const Material& material, const Culling cullingMode, const DepthTest depthTestMode, const Interpolation interpolationMode,
+                        const Rasterization rasterizationMode, const ShadingRate shadingRate){
+    DrawMesh(MainContext, mesh, modelMat, material, cullingMode, depthTestMode, interpolationMode, rasterizationMode, shadingRate);
+}
 
-        #ifdef RENDER_DEBUG_FACE_NORMALS
-            vec3f pos = (t.v1.Position + t.v2.Position + t.v3.Position) / 3;
-            pos = (modelMat * vec4f(pos, 1)).homogenize();
+void Renderer::DrawMesh(RenderContext& context, const Mesh& mesh, const mat4f& modelMat, const Material& material, const Culling cullingMode,
+                        const DepthTest depthTestMode, const Interpolation interpolationMode, const Rasterization rasterizationMode,
+                        const ShadingRate shadingRate){
+    if(!context.IntersectsFrustrum(mesh.Volume, modelMat)){
+        return;
+    }
 
-            vec3f normal = (t.v2.Position - t.v1.Position).cross(t.v3.Position - t.v1.Position).normalize();
-            normal = (modelMat * vec4f(normal, 0)).xyz().normalize();
+    const Mesh& lod = mesh.SelectLod(projectedSize(context, mesh.Volume, modelMat));
 
-            Renderer::DrawLine(pos, pos + normal, Color::White);
-        #endif
+    // Offscreen targets are cleared eagerly and aren't part of the frame
+    if(&context.Target == &MainTarget) touchImmediate(0, 0, FRAME_WIDTH, FRAME_HEIGHT);
 
-        continue;
-    }
+    rasterizeMesh(context, lod, modelMat, material, cullingMode, ShadePass, depthTestMode, interpolationMode, rasterizationMode, shadingRate);
 }
 
 vec3f Renderer::WorldToScreen(vec3f worldPos){
-    return (RVP * vec4f(worldPos, 1)).homogenize();
+    return (MainContext.RVP * vec4f(worldPos, 1)).homogenize();
+}
+
+bool Renderer::IsOccluded(const BoundingVolume& volume){
+    return occluded(volume, mat4f::identity());
 }
 
 void Renderer::Debug::DrawVolume(BoundingVolume& volume, mat4f& modelMat, Color color){
@@ -567,4 +2791,18 @@ void Renderer::Debug::DrawOrientation(mat4f& modelMat){
     Renderer::DrawLine(pos, pos + forward, Color::White, 1, DepthTest::Never);
     Renderer::DrawLine(pos, pos + up, Color::Green, 1, DepthTest::Never);
     Renderer::DrawLine(pos, pos + right, Color::Red, 1, DepthTest::Never);
-}
\ No newline at end of file
+}
+#ifdef RENDER_DEBUG_STATS
+Renderer::Debug::Stats Renderer::Debug::GetStats(){
+    Stats total = {};
+
+    for(int i = 0; i < tileCount; i++){
+        total.PixelsBounded += tileStats[i].PixelsBounded;
+        total.PixelsTested += tileStats[i].PixelsTested;
+        total.PixelsCovered += tileStats[i].PixelsCovered;
+        total.FragmentsShaded += tileStats[i].FragmentsShaded;
+    }
+
+    return total;
+}
+#endif
@@ -1,3 +1,4 @@
+#include <math.h>
 #include "time.hpp"
 #include "common.h"
 
@@ -86,6 +87,47 @@ void Time::Profiler::Reset(){
     times_map.clear();
 };
 
+// The fraction the scale moves towards its estimate every frame, so a single slow frame
+// doesn't make the resolution jump.
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.25f
+// Deviations from the target frame time smaller than this are ignored
+#define DYNAMIC_RESOLUTION_TOLERANCE 0.05f
+
+void Time::DynamicResolution::SetTargetFrameTime(uint64_t microseconds){
+    targetFrameTime = microseconds;
+    if(targetFrameTime == 0) scale = 1;
+};
+
+void Time::DynamicResolution::SetMinScale(float scale){
+    minScale = scale;
+};
+
+float Time::DynamicResolution::Update(){
+    if(targetFrameTime == 0) return scale;
+
+    float drawTime = (float)Profiler::GetSectionMicroseconds("DrawMesh");
+    float fixedTime = (float)Profiler::GetSectionMicroseconds("PostProcessing");
+    float budget = (float)targetFrameTime - fixedTime;
+
+    if(drawTime <= 0) return scale;
+
+    // Rasterization time grows with the pixel count, which is the square of the scale
+    float ratio = budget / drawTime;
+    if(ratio > 1 - DYNAMIC_RESOLUTION_TOLERANCE && ratio < 1 + DYNAMIC_RESOLUTION_TOLERANCE) return scale;
+
+    float estimate = ratio > 0 ? scale * sqrtf(ratio) : minScale;
+    scale += (estimate - scale) * DYNAMIC_RESOLUTION_SMOOTHING;
+
+    if(scale < minScale) scale = minScale;
+    if(scale > 1) scale = 1;
+
+    return scale;
+};
+
+float Time::DynamicResolution::GetScale(){
+    return scale;
+};
+
 #ifdef PLATFORM_NATIVE
 #include <chrono>
 #include <thread>